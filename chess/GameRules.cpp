@@ -41,6 +41,16 @@ SearchGameResult getSearchGameResult(GameState& gameState, RepetitionTable& repT
 	return NotDone;
 }
 
+bool isSearchDraw(GameState& gameState, RepetitionTable& repTable, bool isCheck) {
+	bool drawn = gameState.halfMoves >= 50 || repTable.isRepeated(gameState.zobristHash) || isInsufficientMaterial(gameState);
+	if (!drawn || !isCheck) return drawn;
+
+	// Checkmate takes precedence over the draw rules
+	MoveList moves;
+	generateAllMoves(gameState, moves, gameState.colorToMove);
+	return moves.back > 0;
+}
+
 SearchGameResult getSearchGameResult(GameState& gameState, RepetitionTable& repTable, uint16 moveCount, bool isCheck) {
 	if (moveCount == 0) {
 		if (isCheck) return Checkmate;
@@ -55,3 +55,7 @@ bool isInsufficientMaterial(const GameState& gameState);
 SearchGameResult getSearchGameResult(GameState& gameState, RepetitionTable& repTable, uint16 moveCount);
 
 SearchGameResult getSearchGameResult(GameState& gameState, RepetitionTable& repTable, uint16 moveCount, bool isCheck);
+
+// The draw rules without counting moves first, for searches that generate moves lazily.
+// Only generates moves when in check, to rule out a checkmate.
+bool isSearchDraw(GameState& gameState, RepetitionTable& repTable, bool isCheck);
@@ -94,9 +94,10 @@ void GameState::setPosition(const std::string& fen) {
 
 	enPassantFile = NO_ENPASSANT_FILE;
 	if (enPassant != "-") {
-		enPassantFile = squareCharToInt(enPassant[0]);
-		if (isEnPassantCaptureLegal(enPassantFile, colorToMove)) {
-			zobristHash ^= ENPASSANT_ZOBRIST_KEYS[enPassantFile];
+		uint8 file = squareCharToInt(enPassant[0]);
+		if (isEnPassantCaptureLegal(file, colorToMove)) {
+			zobristHash ^= ENPASSANT_ZOBRIST_KEYS[file];
+			enPassantFile = file;
 		}
 	}
 
@@ -143,11 +144,12 @@ void GameState::makeMove(Move move, std::vector<MoveInfo>& history) {
 		else halfMoves++;
 
 		if (move.isTwoUpMove()) {
+			// Only record the file when it is in the key, otherwise the unconditional xor above on the next move corrupts it
 			int16 file = targetSq & 7;
 			if (isEnPassantCaptureLegal(file, colorToMove == White ? Black : White)) {
 				zobristHash ^= ENPASSANT_ZOBRIST_KEYS[file];
+				enPassantFile = file;
 			}
-			enPassantFile = file;
 		}
 		
 		castlingRights &= CASTLING_RIGHTS_MASK[startSq];
@@ -232,6 +234,8 @@ void GameState::makeMove(Move move, std::vector<MoveInfo>& history) {
 		} break;
 		default: break;
 		}
+		// A promotion can capture a rook on its home square
+		castlingRights &= CASTLING_RIGHTS_MASK[targetSq];
 		zobristHash ^= CASTLING_ZOBRIST_KEYS[castlingRights];
 	};
 
@@ -310,6 +314,93 @@ void GameState::unmakeMove(Move move, std::vector<MoveInfo>& history) {
 	#endif
 }
 
+uint64 GameState::keyAfter(Move move) const {
+	uint16 targetSq = move.getTargetSquare();
+	uint16 startSq = move.getStartSquare();
+	assert(targetSq <= 63 && startSq <= 63);
+
+	Piece piece = pieceAt(startSq);
+	bool iswhite = isWhite(piece);
+	uint16 flags = move.getFlags();
+	uint8 rights = castlingRights;
+
+	uint64 key = zobristHash ^ BLACK_ZOBRIST_KEY;
+	key ^= PIECE_ZOBRIST_KEYS[64*piece + startSq];
+	key ^= CASTLING_ZOBRIST_KEYS[castlingRights];
+	if (enPassantFile != NO_ENPASSANT_FILE) key ^= ENPASSANT_ZOBRIST_KEYS[enPassantFile];
+
+	if (IS_SIMPLE_MOVE[flags]) [[likely]] {
+		if (move.isCapture()) key ^= PIECE_ZOBRIST_KEYS[64*pieceAt(targetSq) + targetSq];
+
+		if (move.isTwoUpMove()) {
+			uint16 file = targetSq & 7;
+			if (isEnPassantCaptureLegal(file, colorToMove == White ? Black : White)) key ^= ENPASSANT_ZOBRIST_KEYS[file];
+		}
+
+		rights &= CASTLING_RIGHTS_MASK[startSq];
+		rights &= CASTLING_RIGHTS_MASK[targetSq];
+		key ^= PIECE_ZOBRIST_KEYS[64*piece + targetSq];
+	}
+	else {
+		switch (flags) {
+		case (EN_PASSANT_FLAG): {
+			uint16 captureSq = iswhite ? targetSq - 8 : targetSq + 8;
+			key ^= PIECE_ZOBRIST_KEYS[64*pieceAt(captureSq) + captureSq];
+			key ^= PIECE_ZOBRIST_KEYS[64*piece + targetSq];
+		} break;
+		case (KING_SIDE_FLAG): {
+			key ^= PIECE_ZOBRIST_KEYS[64*piece + targetSq];
+			if (iswhite) {
+				key ^= PIECE_ZOBRIST_KEYS[WRook*64 + 7] ^ PIECE_ZOBRIST_KEYS[WRook*64 + 5];
+				rights &= (B_KING_SIDE | B_QUEEN_SIDE);
+			}
+			else {
+				key ^= PIECE_ZOBRIST_KEYS[BRook*64 + 63] ^ PIECE_ZOBRIST_KEYS[BRook*64 + 61];
+				rights &= (W_KING_SIDE | W_QUEEN_SIDE);
+			}
+		} break;
+		case (QUEEN_SIDE_FLAG): {
+			key ^= PIECE_ZOBRIST_KEYS[64*piece + targetSq];
+			if (iswhite) {
+				key ^= PIECE_ZOBRIST_KEYS[WRook*64 + 0] ^ PIECE_ZOBRIST_KEYS[WRook*64 + 3];
+				rights &= (B_KING_SIDE | B_QUEEN_SIDE);
+			}
+			else {
+				key ^= PIECE_ZOBRIST_KEYS[BRook*64 + 56] ^ PIECE_ZOBRIST_KEYS[BRook*64 + 59];
+				rights &= (W_KING_SIDE | W_QUEEN_SIDE);
+			}
+		} break;
+		default: {
+			if (move.isCapture()) key ^= PIECE_ZOBRIST_KEYS[64*pieceAt(targetSq) + targetSq];
+			// Promotion flags 10x0 map onto knight, bishop, rook, queen in piece index order
+			Piece promoted = WKnight + ((flags >> 1) & 0b11) + (iswhite ? 0 : BPawn);
+			key ^= PIECE_ZOBRIST_KEYS[64*promoted + targetSq];
+			rights &= CASTLING_RIGHTS_MASK[targetSq];
+		} break;
+		}
+	}
+
+	return key ^ CASTLING_ZOBRIST_KEYS[rights];
+}
+
+uint8 GameState::makeNullMove() {
+	uint8 previousEnPassantFile = enPassantFile;
+	if (enPassantFile != NO_ENPASSANT_FILE) zobristHash ^= ENPASSANT_ZOBRIST_KEYS[enPassantFile];
+	enPassantFile = NO_ENPASSANT_FILE;
+
+	zobristHash ^= BLACK_ZOBRIST_KEY;
+	colorToMove = colorToMove == White ? Black : White;
+	return previousEnPassantFile;
+}
+
+void GameState::unmakeNullMove(uint8 previousEnPassantFile) {
+	colorToMove = colorToMove == White ? Black : White;
+	zobristHash ^= BLACK_ZOBRIST_KEY;
+
+	enPassantFile = previousEnPassantFile;
+	if (enPassantFile != NO_ENPASSANT_FILE) zobristHash ^= ENPASSANT_ZOBRIST_KEYS[enPassantFile];
+}
+
 Piece GameState::tempMakeMove(Move move) {
 	uint16 targetSq = move.getTargetSquare();
 	uint16 startSq = move.getStartSquare();
@@ -461,8 +552,8 @@ bool GameState::isEnPassantCaptureLegal(uint16 enPassantFile, Color color) const
 	const Bitboard epTargetSq = 1ULL << (epRank * 8 + enPassantFile);
 
 	Bitboard potentialAttackers;
-	if (whiteToMove) potentialAttackers = ((epTargetSq >> 7) & ~FILE_H) | ((epTargetSq >> 9) & ~FILE_A);
-	else potentialAttackers = ((epTargetSq << 7) & ~FILE_A) | ((epTargetSq << 9) & ~FILE_H);
+	if (whiteToMove) potentialAttackers = ((epTargetSq >> 7) & ~FILE_A) | ((epTargetSq >> 9) & ~FILE_H);
+	else potentialAttackers = ((epTargetSq << 7) & ~FILE_H) | ((epTargetSq << 9) & ~FILE_A);
 
 	return (pawns & potentialAttackers) != 0ULL;
 }
@@ -28,11 +28,16 @@ typedef struct GameState {
 	void makeMove(Move move, std::vector<MoveInfo>& history);
 	void unmakeMove(Move move, std::vector<MoveInfo>& history);
 
+	// Zobrist key makeMove would produce, without touching the board
+	uint64 keyAfter(Move move) const;
+
 	Piece tempMakeMove(Move move);
 	void tempUnmakeMove(Move move, Piece capturedPiece);
 
-	// void makeNullMove();
-	// void unmakeNullMove();
+	// Passes the turn without touching the board or the history. Returns the en passant file
+	// that unmakeNullMove needs to restore.
+	uint8 makeNullMove();
+	void unmakeNullMove(uint8 previousEnPassantFile);
 
 	void setPiece(uint16 square, Piece piece);
 	void clearSquare(uint16 square);
@@ -79,7 +84,7 @@ inline void makeBKingSide(GameState& g) {
 	g.clearSquare(63); 
 	g.setPiece(61, BRook); 
 	g.zobristHash ^= PIECE_ZOBRIST_KEYS[BRook*64 + 63];
-	g.zobristHash ^= PIECE_ZOBRIST_KEYS[BRook*64 + 63];
+	g.zobristHash ^= PIECE_ZOBRIST_KEYS[BRook*64 + 61];
 }
 inline void makeWQueenSide(GameState& g) { 
 	g.castlingRights &= (B_KING_SIDE | B_QUEEN_SIDE); 
@@ -93,7 +98,7 @@ inline void makeBQueenSide(GameState& g) {
 	g.clearSquare(56); 
 	g.setPiece(59, BRook);
 	g.zobristHash ^= PIECE_ZOBRIST_KEYS[BRook*64 + 56];
-	g.zobristHash ^= PIECE_ZOBRIST_KEYS[BRook*64 + 56];
+	g.zobristHash ^= PIECE_ZOBRIST_KEYS[BRook*64 + 59];
 }
 
 inline void undoWKingSide(GameState& g) { g.clearSquare(5); g.setPiece(7, WRook); g.clearSquare(6); g.setPiece(4, WKing); }
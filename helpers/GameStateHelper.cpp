@@ -323,3 +323,30 @@ void testMakeUnmakeMove() {
 
 	// testAllMoves(state);
 }
+
+void testKeyAfter(GameState state) {
+	std::cout << "\n=== keyAfter Regression ===\n";
+	std::vector<MoveInfo> history;
+	MoveList moves;
+	generateAllMoves(state, moves, state.colorToMove);
+
+	int passed = 0, failed = 0;
+
+	for (const Move& move : moves) {
+		uint64 predicted = state.keyAfter(move);
+		state.makeMove(move, history);
+		uint64 actual = state.zobristHash;
+		state.unmakeMove(move, history);
+
+		if (predicted == actual) {
+			passed++;
+		} else {
+			failed++;
+			std::cout << "Key mismatch for move: " << move.moveToString() << std::endl;
+		}
+	}
+
+	std::cout << "Moves tested: " << moves.back
+		  << " | Passed: " << passed
+		  << " | Failed: " << failed << std::endl;
+}
@@ -14,6 +14,7 @@ bool gameStatesAreEqual(const GameState& state1, const GameState& state2);
 void testMakeUnmake(GameState& startState, const Move& move, const std::string& description);
 void testMakeUnmakeMove();
 void testAllMoves(GameState state);
+void testKeyAfter(GameState state);
 
 void testMakeUnmakePawns();
 void testMakeUnmakeKnights();
@@ -0,0 +1,97 @@
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "LargePages.h"
+
+static uint64 roundUp(uint64 bytes, uint64 pageSize) {
+	return (bytes + pageSize - 1) / pageSize * pageSize;
+}
+
+// Default size of MAP_HUGETLB pages, 0 when the kernel does not report one. Can be 1GB on x86
+// booted with default_hugepagesz=1G or 512MB on arm64 with 64K base pages.
+static uint64 explicitHugePageSize() {
+	static const uint64 size = []() -> uint64 {
+		std::ifstream meminfo("/proc/meminfo");
+		std::string key;
+		uint64 kB;
+		while (meminfo >> key) {
+			if (key == "Hugepagesize:" && meminfo >> kB) return kB * 1024;
+			meminfo.ignore(256, '\n');
+		}
+		return 0;
+	}();
+	return size;
+}
+
+// Size of a transparent huge page, the alignment MADV_HUGEPAGE needs to back a block with them
+static uint64 transparentHugePageSize() {
+	static const uint64 size = []() -> uint64 {
+		std::ifstream pmdSize("/sys/kernel/mm/transparent_hugepage/hpage_pmd_size");
+		uint64 bytes = 0;
+		if (pmdSize >> bytes && bytes > 0 && (bytes & (bytes - 1)) == 0) return bytes;
+		return DEFAULT_HUGE_PAGE_SIZE;
+	}();
+	return size;
+}
+
+// Maps one extra page of alignment and trims both ends so the block starts on an alignment boundary
+static void* mapAligned(uint64 size, uint64 alignment) {
+	void* raw = mmap(nullptr, size + alignment, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (raw == MAP_FAILED) return nullptr;
+
+	uintptr_t start = reinterpret_cast<uintptr_t>(raw);
+	uintptr_t aligned = (start + alignment - 1) & ~(alignment - 1);
+	if (aligned > start) munmap(raw, aligned - start);
+	uint64 tail = start + size + alignment - (aligned + size);
+	if (tail > 0) munmap(reinterpret_cast<void*>(aligned + size), tail);
+	return reinterpret_cast<void*>(aligned);
+}
+
+// Huge pages are skipped when rounding up to one would more than double the block, as it does
+// for small tables on hosts with 1GB or 512MB pages
+static bool fitsHugePage(uint64 bytes, uint64 hugePageSize) {
+	return hugePageSize > 0 && roundUp(bytes, hugePageSize) <= 2 * bytes;
+}
+
+void* allocLargePages(uint64 bytes, LargePageMode& mode, uint64& mappedBytes) {
+#ifdef MAP_HUGETLB
+	if (uint64 hugePageSize = explicitHugePageSize(); fitsHugePage(bytes, hugePageSize)) {
+		const uint64 size = roundUp(bytes, hugePageSize);
+		void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (ptr != MAP_FAILED) {
+			mode = PagesExplicit;
+			mappedBytes = size;
+			return ptr;
+		}
+	}
+#endif
+
+	const bool transparent = fitsHugePage(bytes, transparentHugePageSize());
+	const uint64 alignment = transparent ? transparentHugePageSize() : (uint64)sysconf(_SC_PAGESIZE);
+	const uint64 size = roundUp(bytes, alignment);
+	void* block = mapAligned(size, alignment);
+	if (!block) return nullptr;
+
+	mode = PagesNormal;
+	mappedBytes = size;
+#ifdef MADV_HUGEPAGE
+	if (transparent && madvise(block, size, MADV_HUGEPAGE) == 0) mode = PagesTransparent;
+#endif
+	return block;
+}
+
+void freeLargePages(void* ptr, uint64 mappedBytes) {
+	if (ptr && munmap(ptr, mappedBytes) != 0) std::cerr << "Failed to unmap " << mappedBytes / (1024 * 1024) << "MB of large pages." << std::endl;
+}
+
+const char* largePageModeName(LargePageMode mode) {
+	switch (mode) {
+		case PagesExplicit: return "explicit";
+		case PagesTransparent: return "transparent";
+		default: return "normal";
+	}
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "../chess/Common.h"
+
+// Used when the kernel does not report a huge page size
+constexpr uint64 DEFAULT_HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+// Which kind of pages back an allocation, reported so NPS can be compared per host
+enum LargePageMode : uint8 { PagesNormal, PagesTransparent, PagesExplicit };
+
+// Tries explicit huge pages (MAP_HUGETLB) first, then a mapping aligned to the transparent huge
+// page size and advised with MADV_HUGEPAGE, and falls back to normal pages. Memory comes zeroed
+// from the kernel and is only faulted in on first touch, so allocating is cheap until the table is used.
+// mappedBytes is the length actually mapped, rounded up to the page size used, and is what
+// freeLargePages() needs back.
+void* allocLargePages(uint64 bytes, LargePageMode& mode, uint64& mappedBytes);
+
+void freeLargePages(void* ptr, uint64 mappedBytes);
+
+const char* largePageModeName(LargePageMode mode);
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <chrono>
+#include <ctime>
+#include <iostream>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "../chess/Common.h"
+
+class ScopedTimer {
+public:
+	ScopedTimer(const std::string& name)
+		: name(name), start(std::chrono::high_resolution_clock::now()) {}
+
+	~ScopedTimer() {
+		auto end = std::chrono::high_resolution_clock::now();
+		auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+		std::cout << name << " took " << elapsed << " μs\n";
+	}
+
+private:
+	std::string name;
+	std::chrono::high_resolution_clock::time_point start;
+};
+
+// cntvct() returns raw ticks of a cheap monotonic counter and cntfrq() its ticks per second.
+// AArch64 reads the virtual counter, x86-64 reads the TSC (frequency calibrated once against
+// steady_clock), anything else falls back to clock_gettime in nanoseconds.
+#if defined(__aarch64__)
+
+static inline uint64 cntvct() {
+	uint64 cval;
+	asm volatile("mrs %0, cntvct_el0" : "=r" (cval));
+	return cval;
+}
+
+static inline uint64 cntfrq() {
+	uint64 freq;
+	asm volatile("mrs %0, cntfrq_el0" : "=r" (freq));
+	return freq;
+}
+
+#elif defined(__x86_64__) || defined(__i386__)
+
+static inline uint64 cntvct() { return __rdtsc(); }
+
+inline uint64 calibrateTsc() {
+	constexpr auto CALIBRATION_TIME = std::chrono::milliseconds(5);
+	auto start = std::chrono::steady_clock::now();
+	uint64 startTicks = __rdtsc();
+	while (std::chrono::steady_clock::now() - start < CALIBRATION_TIME) {}
+	auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+	uint64 ticks = __rdtsc() - startTicks;
+	return ticks * 1000000000ULL / static_cast<uint64>(elapsed);
+}
+
+// Not static, so every translation unit shares the one calibrated value
+inline uint64 cntfrq() {
+	static const uint64 freq = calibrateTsc();
+	return freq;
+}
+
+#else
+
+static inline uint64 cntvct() {
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return static_cast<uint64>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline uint64 cntfrq() { return 1000000000ULL; }
+
+#endif
+
+inline uint64 getTimeElapsed(uint64 startTime) {
+	return (cntvct() - startTime) * 1000 / cntfrq();
+}
+
+inline uint64 getTimeElapsedUS(uint64 startTime) {
+	return (cntvct() - startTime) * 1000000 / cntfrq();
+}
+
+inline double uint64ToElapsedUS(uint64 t) {
+	return static_cast<double>(t) * 1e6 / static_cast<double>(cntfrq());
+}
+
+class SearchScopedTimer {
+public:
+	SearchScopedTimer(uint64& time)
+		: time(time), start(cntvct()) {}
+
+	~SearchScopedTimer() {
+		time += cntvct() - start;
+	}
+
+private:
+	uint64& time;
+	uint64 start;
+
+};
+
@@ -1,10 +1,14 @@
+#include <algorithm>
+#include <charconv>
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "chess/Common.h"
 #include "search/Search.h"
+#include "search/TranspositionTable.h"
 
 #include "helpers/GameStateHelper.h"
 #include "movegen/MoveGenTest.h"
@@ -12,6 +16,18 @@
 #include "movegen/PrecomputedTables.h"
 
 
+// Parses a spin option value and clamps it to [min, max]. Anything that is not a whole number is reported and ignored.
+static bool parseSpinValue(const std::string& name, const std::string& value, int64 min, int64 max, int64& result) {
+	int64 parsed;
+	auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), parsed);
+	if (value.empty() || error != std::errc() || end != value.data() + value.size()) {
+		std::cout << "info string invalid value " << value << " for option " << name << std::endl;
+		return false;
+	}
+	result = std::clamp(parsed, min, max);
+	return true;
+}
+
 int main() {
 	std::ios::sync_with_stdio(false);
 	std::cin.tie(nullptr);
@@ -20,18 +36,56 @@ int main() {
 	std::vector<MoveInfo> history;
 	history.reserve(256);
 
-	iterativeDeepeningSearch(gameState, history);
+	// go runs on its own thread so isready, stop and quit are answered during the search
+	std::thread searchThread;
+	auto waitForSearch = [&searchThread]() { if (searchThread.joinable()) searchThread.join(); };
 
 	std::string command;
 	while (std::getline(std::cin, command)) {
+		// Everything else reads or changes engine state, so it waits for a running search to finish
+		if (command != "isready" && command != "stop" && command != "quit") waitForSearch();
+
 		if (command == "uci") {
 			std::cout << "id name ChessV4" << std::endl;
 			std::cout << "id author EnohMihulet" << std::endl;
+			std::cout << "option name Hash type spin default " << DEFAULT_TT_SIZE_MB << " min " << MIN_TT_SIZE_MB << " max " << MAX_TT_SIZE_MB << std::endl;
+			std::cout << "option name Threads type spin default 1 min 1 max " << MAX_SEARCH_THREADS << std::endl;
+			std::cout << "option name Move Overhead type spin default " << DEFAULT_MOVE_OVERHEAD_MS << " min 0 max " << MAX_MOVE_OVERHEAD_MS << std::endl;
+			std::cout << "option name MultiPV type spin default 1 min 1 max " << (int)MAX_MULTI_PV << std::endl;
 			std::cout << "uciok" << std::endl;
 		}
 
+		// Tables are allocated here rather than at startup, unless a search is still running
 		else if (command == "isready") {
-			std::cout << "readyok" << std::endl;
+			if (!searchThread.joinable() && prepareSearchTables()) printLine("info string " + getLargePageReport());
+			printLine("readyok");
+		}
+
+		else if (command == "stop") {
+			requestSearchStop();
+			waitForSearch();
+		}
+
+		else if (command.rfind("setoption", 0) == 0) {
+			std::istringstream ss(command);
+			std::string token, name, value;
+			ss >> token >> token;
+			while (ss >> token && token != "value") name += (name.empty() ? "" : " ") + token;
+			ss >> value;
+
+			int64 n;
+			if (name == "Hash") {
+				if (parseSpinValue(name, value, MIN_TT_SIZE_MB, MAX_TT_SIZE_MB, n)) resizeTranspositionTable(n);
+			}
+			else if (name == "Threads") {
+				if (parseSpinValue(name, value, 1, MAX_SEARCH_THREADS, n)) setSearchThreads(n);
+			}
+			else if (name == "Move Overhead") {
+				if (parseSpinValue(name, value, 0, MAX_MOVE_OVERHEAD_MS, n)) setMoveOverhead(n);
+			}
+			else if (name == "MultiPV") {
+				if (parseSpinValue(name, value, 1, MAX_MULTI_PV, n)) setMultiPV(n);
+			}
 		}
 
 		else if (command == "ucinewgame") {
@@ -40,6 +94,37 @@ int main() {
 			gameState.setPosition((std::string) DEFAULT_FEN_POSITION);
 		}
 
+		else if (command.rfind("savett ", 0) == 0) {
+			std::string path = command.substr(7);
+			if (saveTranspositionTable(path)) std::cout << "info string saved transposition table to " << path << std::endl;
+		}
+
+		else if (command.rfind("loadtt ", 0) == 0) {
+			std::string path = command.substr(7);
+			if (loadTranspositionTable(path)) std::cout << "info string loaded transposition table from " << path << std::endl;
+		}
+
+		// Optional warm-up that faults in the tables and caches before the first real search
+		else if (command.rfind("warmup", 0) == 0) {
+			std::istringstream ss(command);
+			std::string token;
+			SearchLimits limits;
+			limits.moveTime = 1000;
+			ss >> token >> limits.moveTime;
+			GameState warmupState((std::string) DEFAULT_FEN_POSITION);
+			std::vector<MoveInfo> warmupHistory;
+			iterativeDeepeningSearch(warmupState, warmupHistory, limits);
+			printLine("info string warmup done");
+		}
+
+		else if (command.rfind("smpbench", 0) == 0) {
+			std::istringstream ss(command);
+			std::string token;
+			int16 depth = 8;
+			ss >> token >> depth;
+			runThreadScalingBenchmark(depth);
+		}
+
 		else if (command.rfind("position", 0) == 0) {
 			std::istringstream ss(command);
 			std::string token;
@@ -70,20 +155,36 @@ int main() {
 		}
 
 		else if (command.rfind("go", 0) == 0) {
-			int16 depth = 5;
+			SearchLimits limits;
 			std::istringstream ss(command);
 			std::string token;
-			while (ss >> token) if (token == "depth") ss >> depth;
+			while (ss >> token) {
+				if (token == "wtime") ss >> limits.time[White];
+				else if (token == "btime") ss >> limits.time[Black];
+				else if (token == "winc") ss >> limits.inc[White];
+				else if (token == "binc") ss >> limits.inc[Black];
+				else if (token == "movestogo") ss >> limits.movesToGo;
+				else if (token == "movetime") ss >> limits.moveTime;
+				else if (token == "depth") ss >> limits.depth;
+				else if (token == "infinite") limits.infinite = true;
+			}
 
-			Move bestMove = iterativeDeepeningSearch(gameState, history);
-			std::cout << gameState.toFenString() << std::endl;
-			std::cout << "bestmove " << bestMove.moveToString() << std::endl;
+			clearSearchStop();
+			searchThread = std::thread([gameState, history, limits]() mutable {
+				Move bestMove = iterativeDeepeningSearch(gameState, history, limits);
+				printLine(gameState.toFenString());
+				printLine("bestmove " + bestMove.moveToString());
+			});
 		}
 
 		else if (command == "quit") {
+			requestSearchStop();
+			waitForSearch();
 			break;
 		}
 	}
 
+	waitForSearch();
+
 	return 0;
 }
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <iostream>
 #include <vector>
 
@@ -113,6 +114,16 @@ Bitboard getPossibleRookAttackers(uint8 square, Bitboard occupied) {
 	return allAttackers;
 }
 
+Bitboard getAttackersTo(const GameState& gameState, uint8 square, Bitboard occupied) {
+	const Bitboard* bb = gameState.bitboards.data();
+	Bitboard attackers = (PAWN_ATTACK_TABLE[Black][square] & bb[WPawn]) | (PAWN_ATTACK_TABLE[White][square] & bb[BPawn]);
+	attackers |= KNIGHT_ATTACK_TABLE[square] & (bb[WKnight] | bb[BKnight]);
+	attackers |= KING_ATTACK_TABLE[square] & (bb[WKing] | bb[BKing]);
+	attackers |= getPossibleBishopAttackers(square, occupied) & (bb[WBishop] | bb[BBishop] | bb[WQueen] | bb[BQueen]);
+	attackers |= getPossibleRookAttackers(square, occupied) & (bb[WRook] | bb[BRook] | bb[WQueen] | bb[BQueen]);
+	return attackers & occupied;
+}
+
 void computeCheckAndPinMasks(const GameState& gameState, Color us, Bitboard& checkMask, Bitboard& pinnedPieces, std::array<Bitboard, 64>& pinnedRays) {
 	Bitboard king = us == White ? gameState.bitboards[WKing] : gameState.bitboards[BKing];
 	uint8 kingSq; 
@@ -549,6 +560,44 @@ void generateQueenMoves(GameState& gameState, MoveList& moves, Color us, Bitboar
 	}
 }
 
+static void generateCastlingMoves(const GameState& gameState, MoveList& moves, Color us, uint8 from, Bitboard& checkMask) {
+	Color them = us == White ? Black : White;
+	Bitboard empty = ~(gameState.bitboards[AllIndex]);
+
+	if (us == White) {
+		if ((gameState.castlingRights & W_KING_SIDE) &&
+			(empty & ((1ULL << 5) | (1ULL << 6))) == ((1ULL << 5) | (1ULL << 6))) {
+			if (!isSquareAttacked(gameState, 1ULL << 5, them) &&
+				!isSquareAttacked(gameState, 1ULL << 6, them) &&
+				checkMask == ~0ULL) 
+				moves.push(Move(from, 6, KING_SIDE_FLAG));
+		}
+		if ((gameState.castlingRights & W_QUEEN_SIDE) &&
+			(empty & ((1ULL << 1) | (1ULL << 2) | (1ULL << 3))) == ((1ULL << 1) | (1ULL << 2) | (1ULL << 3))) {
+			if (!isSquareAttacked(gameState, 1ULL << 3, them) &&
+				!isSquareAttacked(gameState, 1ULL << 2, them) &&
+				checkMask == ~0ULL)
+			moves.push(Move(from, 2, QUEEN_SIDE_FLAG));
+		}
+	}
+	else {
+		if ((gameState.castlingRights & B_KING_SIDE) &&
+			(empty & ((1ULL << 61) | (1ULL << 62))) == ((1ULL << 61) | (1ULL << 62))) {
+			if (!isSquareAttacked(gameState, 1ULL << 61, them) &&
+				!isSquareAttacked(gameState, 1ULL << 62, them) &&
+				checkMask == ~0ULL) 
+			moves.push(Move(from, 62, KING_SIDE_FLAG));
+		}
+		if ((gameState.castlingRights & B_QUEEN_SIDE) &&
+			(empty & ((1ULL << 57) | (1ULL << 58) | (1ULL << 59))) == ((1ULL << 57) | (1ULL << 58) | (1ULL << 59))) {
+			if (!isSquareAttacked(gameState, 1ULL << 59, them) &&
+				!isSquareAttacked(gameState, 1ULL << 58, them) &&
+				checkMask == ~0ULL)
+			moves.push(Move(from, 58, QUEEN_SIDE_FLAG));
+		}
+	}
+}
+
 void generateKingMoves(GameState& gameState, MoveList& moves, Color us, Bitboard& checkMask) {
 	Color them = us == White ? Black : White;
 	auto moveLoop = [&](Bitboard bb, uint8 from) {
@@ -594,38 +643,7 @@ void generateKingMoves(GameState& gameState, MoveList& moves, Color us, Bitboard
 	moveLoop(noncaptures, from);
 	captureLoop(captures, from);
 
-	if (us == White) {
-		if ((gameState.castlingRights & W_KING_SIDE) &&
-			(empty & ((1ULL << 5) | (1ULL << 6))) == ((1ULL << 5) | (1ULL << 6))) {
-			if (!isSquareAttacked(gameState, 1ULL << 5, them) &&
-				!isSquareAttacked(gameState, 1ULL << 6, them) &&
-				checkMask == ~0ULL) 
-				moves.push(Move(from, 6, KING_SIDE_FLAG));
-		}
-		if ((gameState.castlingRights & W_QUEEN_SIDE) &&
-			(empty & ((1ULL << 1) | (1ULL << 2) | (1ULL << 3))) == ((1ULL << 1) | (1ULL << 2) | (1ULL << 3))) {
-			if (!isSquareAttacked(gameState, 1ULL << 3, them) &&
-				!isSquareAttacked(gameState, 1ULL << 2, them) &&
-				checkMask == ~0ULL)
-			moves.push(Move(from, 2, QUEEN_SIDE_FLAG));
-		}
-	}
-	else {
-		if ((gameState.castlingRights & B_KING_SIDE) &&
-			(empty & ((1ULL << 61) | (1ULL << 62))) == ((1ULL << 61) | (1ULL << 62))) {
-			if (!isSquareAttacked(gameState, 1ULL << 61, them) &&
-				!isSquareAttacked(gameState, 1ULL << 62, them) &&
-				checkMask == ~0ULL) 
-			moves.push(Move(from, 62, KING_SIDE_FLAG));
-		}
-		if ((gameState.castlingRights & B_QUEEN_SIDE) &&
-			(empty & ((1ULL << 57) | (1ULL << 58) | (1ULL << 59))) == ((1ULL << 57) | (1ULL << 58) | (1ULL << 59))) {
-			if (!isSquareAttacked(gameState, 1ULL << 59, them) &&
-				!isSquareAttacked(gameState, 1ULL << 58, them) &&
-				checkMask == ~0ULL)
-			moves.push(Move(from, 58, QUEEN_SIDE_FLAG));
-		}
-	}
+	generateCastlingMoves(gameState, moves, us, from, checkMask);
 }
 
 void generateAllMoves(GameState& gameState, MoveList& moves, Color us) {
@@ -1018,3 +1036,243 @@ void generateAllCaptureMoves(GameState& gameState, MoveList& moves, Color us, Bi
 	generateKingCaptureMoves(gameState, moves, us);
 }
 
+
+void generatePawnQuietMoves(GameState& gameState, MoveList& moves, Color us, Bitboard& checkMask, Bitboard& pinnedPieces, std::array<Bitboard, 64>& pinnedRays) {
+	auto pushLoop = [&](Bitboard bb, int16 shift, uint16 promotionRank) {
+		while (bb) {
+			uint16 to = __builtin_ctzll(bb);
+			uint16 from = to - shift;
+
+			if ((pinnedPieces & (1ULL << from)) && !(pinnedRays[from] & (1ULL << to))) {
+				bb &= bb - 1;
+				continue;
+			}
+
+			if ((us == White && to/8 >= promotionRank) || (us == Black && to/8 <= promotionRank)) {
+				moves.push(Move(from, to, QUEEN_PROMOTE_FLAG));
+				moves.push(Move(from, to, KNIGHT_PROMOTE_FLAG));
+				moves.push(Move(from, to, ROOK_PROMOTE_FLAG));
+				moves.push(Move(from, to, BISHOP_PROMOTE_FLAG));
+			} else moves.push(Move(from, to, NO_FLAG));
+			bb &= bb - 1;
+		}
+	};
+
+	auto doublePushLoop = [&](Bitboard bb, int16 shift) {
+		while (bb) {
+			uint16 to = __builtin_ctzll(bb);
+			uint16 from = to - shift;
+
+			if (pinnedPieces & (1ULL << from) && !(pinnedRays[from] & (1ULL << to))) {
+				bb &= bb - 1;
+				continue;
+			}
+
+			moves.push(Move(from, to, PAWN_TWO_UP_FLAG));
+			bb &= bb - 1;
+		}
+	};
+
+	Bitboard empty = ~gameState.bitboards[AllIndex];
+
+	if (us == White) {
+		Bitboard pawns = gameState.bitboards[WPawn];
+		Bitboard singlePushes = pawns << 8 & empty & checkMask;
+		Bitboard doublePushes = ((pawns << 8) & empty & RANK_3) << 8 & empty & checkMask;
+
+		pushLoop(singlePushes, 8, 7);
+		doublePushLoop(doublePushes, 16);
+	}
+	else {
+		Bitboard pawns = gameState.bitboards[BPawn];
+		Bitboard singlePushes = pawns >> 8 & empty & checkMask;
+		Bitboard doublePushes = ((pawns >> 8) & empty & RANK_6) >> 8 & empty & checkMask;
+
+		pushLoop(singlePushes, -8, 0);
+		doublePushLoop(doublePushes, -16);
+	}
+}
+
+void generateKnightQuietMoves(GameState& gameState, MoveList& moves, Color us, Bitboard& checkMask, Bitboard& pinnedPieces) {
+	Bitboard empty = ~gameState.bitboards[AllIndex];
+	Bitboard knights = (us == White) ? gameState.bitboards[WKnight] : gameState.bitboards[BKnight];
+
+	// A pinned knight can never move
+	knights &= ~pinnedPieces;
+	while (knights) {
+		const uint8 from = __builtin_ctzll(knights);
+		Bitboard noncaptures = KNIGHT_ATTACK_TABLE[from] & checkMask & empty;
+
+		while (noncaptures) {
+			moves.push(Move(from, __builtin_ctzll(noncaptures), NO_FLAG));
+			noncaptures &= noncaptures - 1;
+		}
+		knights &= (knights - 1);
+	}
+}
+
+// Quiet moves of the sliders along the rays in directionIndices, shared by bishops, rooks and queens
+static void generateSliderQuietMoves(GameState& gameState, MoveList& moves, Bitboard sliders, const int8* directionIndices, const bool* decreases, uint8 directionCount,
+				     Bitboard& checkMask, Bitboard& pinnedPieces, std::array<Bitboard, 64>& pinnedRays) {
+	Bitboard all = gameState.bitboards[AllIndex];
+
+	while (sliders) {
+		uint8 from = __builtin_ctzll(sliders);
+		Bitboard allowed = checkMask;
+		if (pinnedPieces & (1ULL << from)) allowed &= pinnedRays[from];
+
+		for (uint8 i = 0; i < directionCount; i++) {
+			Bitboard ray = RAY_MASK[from][directionIndices[i]];
+			Bitboard intersectionWithPiece = all & ray;
+
+			Bitboard nonCaptures = ray;
+			if (intersectionWithPiece) {
+				uint8 firstPieceSq = decreases[i] ? 63 - __builtin_clzll(intersectionWithPiece) : __builtin_ctzll(intersectionWithPiece);
+				nonCaptures = RAY_BETWEEN[from][firstPieceSq];
+			}
+			nonCaptures &= allowed;
+
+			while (nonCaptures) {
+				moves.push(Move(from, __builtin_ctzll(nonCaptures), NO_FLAG));
+				nonCaptures &= nonCaptures - 1;
+			}
+		}
+		sliders &= sliders - 1;
+	}
+}
+
+void generateBishopQuietMoves(GameState& gameState, MoveList& moves, Color us, Bitboard& checkMask, Bitboard& pinnedPieces, std::array<Bitboard, 64>& pinnedRays) {
+	Bitboard bishops = us == White ? gameState.bitboards[WBishop] : gameState.bitboards[BBishop];
+	generateSliderQuietMoves(gameState, moves, bishops, DIAGONAL_RAY_TABLE_INDICIES, DIAGONAL_DECREASES, 4, checkMask, pinnedPieces, pinnedRays);
+}
+
+void generateRookQuietMoves(GameState& gameState, MoveList& moves, Color us, Bitboard& checkMask, Bitboard& pinnedPieces, std::array<Bitboard, 64>& pinnedRays) {
+	Bitboard rooks = us == White ? gameState.bitboards[WRook] : gameState.bitboards[BRook];
+	generateSliderQuietMoves(gameState, moves, rooks, STRAIGHT_RAY_TABLE_INDICIES, STRAIGHT_DECREASES, 4, checkMask, pinnedPieces, pinnedRays);
+}
+
+void generateQueenQuietMoves(GameState& gameState, MoveList& moves, Color us, Bitboard& checkMask, Bitboard& pinnedPieces, std::array<Bitboard, 64>& pinnedRays) {
+	Bitboard queens = us == White ? gameState.bitboards[WQueen] : gameState.bitboards[BQueen];
+	generateSliderQuietMoves(gameState, moves, queens, RAY_TABLE_INDICIES, DIRECTION_DECREASES, 8, checkMask, pinnedPieces, pinnedRays);
+}
+
+void generateKingQuietMoves(GameState& gameState, MoveList& moves, Color us, Bitboard& checkMask) {
+	Color them = us == White ? Black : White;
+	Bitboard empty = ~(gameState.bitboards[AllIndex]);
+	Bitboard kings = us == White ? gameState.bitboards[WKing] : gameState.bitboards[BKing];
+
+	uint8 from;
+	if (kings) from = __builtin_ctzll(kings);
+	else return;
+
+	Bitboard noncaptures = KING_ATTACK_TABLE[from] & empty;
+	while (noncaptures) {
+		uint8 to = __builtin_ctzll(noncaptures);
+
+		Move move(from, to, NO_FLAG); 
+		gameState.tempMakeMove(move);
+		if (!isSquareAttacked(gameState, 1ULL << to, them)) moves.push(move);
+		gameState.tempUnmakeMove(move, EMPTY);
+
+		noncaptures &= noncaptures - 1;
+	}
+
+	generateCastlingMoves(gameState, moves, us, from, checkMask);
+}
+
+void generateAllQuietMoves(GameState& gameState, MoveList& moves, Color us, Bitboard& checkMask, Bitboard& pinnedPieces, std::array<Bitboard, 64>& pinnedRays) {
+	if (checkMask == 0ULL) {
+		generateKingQuietMoves(gameState, moves, us, checkMask);
+		return;
+	}
+
+	generatePawnQuietMoves(gameState, moves, us, checkMask, pinnedPieces, pinnedRays);
+	generateKnightQuietMoves(gameState, moves, us, checkMask, pinnedPieces);
+	generateBishopQuietMoves(gameState, moves, us, checkMask, pinnedPieces, pinnedRays);
+	generateRookQuietMoves(gameState, moves, us, checkMask, pinnedPieces, pinnedRays);
+	generateQueenQuietMoves(gameState, moves, us, checkMask, pinnedPieces, pinnedRays);
+	generateKingQuietMoves(gameState, moves, us, checkMask);
+}
+
+// Checks a move that did not come from the generator, e.g. from the TT or the killer table, against
+// the current position. Everything except leaving the own king in check is verified, see isLegal.
+bool isPseudoLegal(const GameState& gameState, Move move) {
+	if (move.isNull()) return false;
+
+	Color us = gameState.colorToMove;
+	Color them = us == White ? Black : White;
+	uint8 from = move.getStartSquare();
+	uint8 to = move.getTargetSquare();
+	uint16 flags = move.getFlags();
+
+	Piece piece = gameState.pieceAt(from);
+	if (piece == EMPTY || isWhite(piece) != (us == White)) return false;
+
+	Bitboard occupied = gameState.bitboards[AllIndex];
+	Bitboard enemies = us == White ? gameState.bitboards[BlackIndex] : gameState.bitboards[WhiteIndex];
+	Bitboard toBB = 1ULL << to;
+	Piece type = isWhite(piece) ? piece : piece - BPawn;
+
+	// 0b0101 and 0b0111 are not used by any move
+	if (flags == (KING_SIDE_FLAG | CAPTURE_FLAG) || flags == (QUEEN_SIDE_FLAG | CAPTURE_FLAG)) return false;
+
+	if (move.isKingSideCastle() || move.isQueenSideCastle()) {
+		if (type != WKing) return false;
+		Bitboard king = 1ULL << from;
+		Bitboard checkMask = isSquareAttacked(gameState, king, them) ? 0ULL : ~0ULL;
+		MoveList castles;
+		generateCastlingMoves(gameState, castles, us, from, checkMask);
+		return std::any_of(castles.begin(), castles.end(), [&](Move m) { return m.val == move.val; });
+	}
+
+	if (type == WPawn) {
+		bool lastRank = us == White ? to / 8 == 7 : to / 8 == 0;
+		if (move.isPromotion() != lastRank) return false;
+
+		if (move.isEnPassant()) {
+			if (gameState.enPassantFile == NO_ENPASSANT_FILE) return false;
+			uint8 epSquare = gameState.enPassantFile + (us == White ? 40 : 16);
+			return to == epSquare && (PAWN_ATTACK_TABLE[us][from] & toBB);
+		}
+		if (move.isCapture()) return PAWN_ATTACK_TABLE[us][from] & toBB & enemies;
+
+		int8 forward = us == White ? 8 : -8;
+		if (occupied & toBB) return false;
+		if (move.isTwoUpMove()) {
+			bool onStartRank = us == White ? from / 8 == 1 : from / 8 == 6;
+			return onStartRank && to == from + 2 * forward && !(occupied & (1ULL << (from + forward)));
+		}
+		return to == from + forward;
+	}
+
+	if (flags != NO_FLAG && flags != CAPTURE_FLAG) return false;
+	if (move.isCapture() != static_cast<bool>(toBB & enemies)) return false;
+	if (!move.isCapture() && (occupied & toBB)) return false;
+
+	Bitboard straight = RAY_MASK[from][RIGHT_RAY_TABLE_INDEX] | RAY_MASK[from][UP_RAY_TABLE_INDEX]
+			  | RAY_MASK[from][LEFT_RAY_TABLE_INDEX] | RAY_MASK[from][DOWN_RAY_TABLE_INDEX];
+	Bitboard diagonal = RAY_MASK[from][UP_RIGHT_RAY_TABLE_INDEX] | RAY_MASK[from][UP_LEFT_RAY_TABLE_INDEX]
+			  | RAY_MASK[from][DOWN_LEFT_RAY_TABLE_INDEX] | RAY_MASK[from][DOWN_RIGHT_RAY_TABLE_INDEX];
+	bool pathClear = !(RAY_BETWEEN[from][to] & occupied);
+
+	switch (type) {
+		case WKnight: return KNIGHT_ATTACK_TABLE[from] & toBB;
+		case WBishop: return (diagonal & toBB) && pathClear;
+		case WRook: return (straight & toBB) && pathClear;
+		case WQueen: return ((straight | diagonal) & toBB) && pathClear;
+		case WKing: return KING_ATTACK_TABLE[from] & toBB;
+		default: return false;
+	}
+}
+
+bool isLegal(GameState& gameState, Move move) {
+	Color us = gameState.colorToMove;
+	Color them = us == White ? Black : White;
+
+	Piece capturedPiece = gameState.tempMakeMove(move);
+	Bitboard king = us == White ? gameState.bitboards[WKing] : gameState.bitboards[BKing];
+	bool legal = !isSquareAttacked(gameState, king, them);
+	gameState.tempUnmakeMove(move, capturedPiece);
+
+	return legal;
+}
@@ -11,6 +11,10 @@ Bitboard getPossibleBishopAttackers(uint8 square, Bitboard occupied);
 
 Bitboard getPossibleRookAttackers(uint8 square, Bitboard occupied);
 
+// Pieces of both colors attacking square, with sliders seen through the given occupancy so
+// that removing a piece from it uncovers the x-ray attacker behind it
+Bitboard getAttackersTo(const GameState& gameState, uint8 square, Bitboard occupied);
+
 void computeCheckAndPinMasks(const GameState& gameState, Color us, Bitboard& checkMask, Bitboard& pinnedPieces, std::array<Bitboard, 64>& pinnedRays);
 
 void generatePawnMoves(GameState& gameState, MoveList& moves, Color us, Bitboard& checkMask, Bitboard& pinnedPieces, std::array<Bitboard, 64>& pinnedRays);
@@ -32,3 +36,16 @@ void generateKingCaptureMoves(GameState& gameState, MoveList& moves, Color us);
 void generateAllCaptureMoves(GameState& gameState, MoveList& moves, Color us);
 void generateAllCaptureMoves(GameState& gameState, MoveList& moves, Color us, Bitboard& checkMask, Bitboard& pinnedPieces, std::array<Bitboard, 64>& pinnedRays);
 
+// Non-captures only, quiet promotions included. Together with generateAllCaptureMoves this is generateAllMoves.
+void generatePawnQuietMoves(GameState& gameState, MoveList& moves, Color us, Bitboard& checkMask, Bitboard& pinnedPieces, std::array<Bitboard, 64>& pinnedRays);
+void generateKnightQuietMoves(GameState& gameState, MoveList& moves, Color us, Bitboard& checkMask, Bitboard& pinnedPieces);
+void generateBishopQuietMoves(GameState& gameState, MoveList& moves, Color us, Bitboard& checkMask, Bitboard& pinnedPieces, std::array<Bitboard, 64>& pinnedRays);
+void generateRookQuietMoves(GameState& gameState, MoveList& moves, Color us, Bitboard& checkMask, Bitboard& pinnedPieces, std::array<Bitboard, 64>& pinnedRays);
+void generateQueenQuietMoves(GameState& gameState, MoveList& moves, Color us, Bitboard& checkMask, Bitboard& pinnedPieces, std::array<Bitboard, 64>& pinnedRays);
+void generateKingQuietMoves(GameState& gameState, MoveList& moves, Color us, Bitboard& checkMask);
+void generateAllQuietMoves(GameState& gameState, MoveList& moves, Color us, Bitboard& checkMask, Bitboard& pinnedPieces, std::array<Bitboard, 64>& pinnedRays);
+
+// For moves that did not come from the generator. isLegal expects a pseudo legal move and
+// only checks that it does not leave the own king attacked.
+bool isPseudoLegal(const GameState& gameState, Move move);
+bool isLegal(GameState& gameState, Move move);
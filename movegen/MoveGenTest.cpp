@@ -268,3 +268,58 @@ void testKingMoveGeneration() {
 	testPieceMoveGeneration("8/8/8/8/8/8/8/R3K2R w KQ - 1 1", WKing, "e1f1 e1e2 e1d1 e1d2 e1f2 e1g1 e1c1");
 	testPieceMoveGeneration("r3k2r/8/8/8/8/8/8/8 b kq - 1 1", BKing, "e8f8 e8d8 e8e7 e8f7 e8d7 e8g8 e8c8");
 }
+
+// Walks every position up to depth plies deep and checks that captures plus quiets is exactly the full
+// move list, and that isPseudoLegal and isLegal accept exactly the generated moves out of all 2^16 encodings.
+static uint64 checkStagedMoveGeneration(GameState& state, std::vector<MoveInfo>& history, uint8 depth) {
+	uint64 failures = 0;
+	MoveList all;
+	generateAllMoves(state, all, state.colorToMove);
+
+	MoveList staged;
+	Bitboard checkMask, pinnedPieces;
+	std::array<Bitboard, 64> pinnedRays;
+	generateAllCaptureMoves(state, staged, state.colorToMove, checkMask, pinnedPieces, pinnedRays);
+	if (checkMask != 0ULL) generateAllQuietMoves(state, staged, state.colorToMove, checkMask, pinnedPieces, pinnedRays);
+
+	std::array<bool, 1 << 16> generated{};
+	for (Move move : all) generated[move.val] = true;
+
+	bool sameMoves = staged.back == all.back;
+	for (Move move : staged) sameMoves = sameMoves && generated[move.val];
+	for (uint32 val = 0; val < (1 << 16); val++) {
+		Move move(static_cast<uint16>(val));
+		if ((isPseudoLegal(state, move) && isLegal(state, move)) != generated[val]) {
+			std::cerr << "[FAIL] " << state.toFenString() << " legality of " << move.moveToString() << "\n";
+			failures++;
+		}
+	}
+	if (!sameMoves) {
+		std::cerr << "[FAIL] " << state.toFenString() << " staged generation differs\n";
+		failures++;
+	}
+
+	if (depth == 0) return failures;
+	for (Move move : all) {
+		state.makeMove(move, history);
+		failures += checkStagedMoveGeneration(state, history, depth - 1);
+		state.unmakeMove(move, history);
+	}
+	return failures;
+}
+
+void testStagedMoveGeneration() {
+	const std::string fens[] = {
+		std::string(DEFAULT_FEN_POSITION),
+		"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+		"8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+		"rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+	};
+
+	for (const std::string& fen : fens) {
+		GameState state(fen);
+		std::vector<MoveInfo> history;
+		uint64 failures = checkStagedMoveGeneration(state, history, 2);
+		if (failures == 0) std::cout << "[OK]   staged generation " << fen << "\n";
+	}
+}
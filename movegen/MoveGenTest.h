@@ -20,3 +20,4 @@ void testBishopMoveGeneration();
 void testRookMoveGeneration();
 void testQueenMoveGeneration();
 void testKingMoveGeneration();
+void testStagedMoveGeneration();
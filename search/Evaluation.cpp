@@ -242,7 +242,13 @@ void evaluateKing(GameState& gameState, EvalState& eval, Color us) {
 }
 
 void updateEval(GameState& gameState, Move move, Color us, EvalState& eval, std::vector<EvalDelta>& evalStack) {
-	EvalDelta delta{};
+	EvalDelta delta;
+	updateEval(gameState, move, us, eval, delta);
+	evalStack.push_back(delta);
+}
+
+void updateEval(GameState& gameState, Move move, Color us, EvalState& eval, EvalDelta& delta) {
+	delta = EvalDelta{};
 	Piece moved = gameState.pieceAt(move.getStartSquare());
 	Piece capture = move.isEnPassant() ? us == White ? BPawn : WPawn : gameState.pieceAt(move.getTargetSquare());
 
@@ -292,7 +298,6 @@ void updateEval(GameState& gameState, Move move, Color us, EvalState& eval, std:
 	}
 
 	applyEvalDelta(eval, delta);
-	evalStack.push_back(delta);
 }
 
 void applyEvalDelta(EvalState& evalState, EvalDelta& evalDelta) {
@@ -311,8 +316,11 @@ void applyEvalDelta(EvalState& evalState, EvalDelta& evalDelta) {
 }
 
 void undoEvalUpdate(EvalState& evalState, std::vector<EvalDelta>& evalStack) {
-	EvalDelta evalDelta = evalStack.back();
+	undoEvalUpdate(evalState, evalStack.back());
 	evalStack.pop_back();
+}
+
+void undoEvalUpdate(EvalState& evalState, const EvalDelta& evalDelta) {
 	evalState.phase -= evalDelta.phase;
 	for (uint8 c = 0; c < 2; c++) {
 		evalState.mgSide[c] -= evalDelta.mgSide[c];
@@ -81,8 +81,11 @@ void evaluateQueen(GameState& gameState, EvalState& eval, Color us);
 void evaluateKing(GameState& gameState, EvalState& eval, Color us);
 
 void updateEval(GameState& gameState, Move move, Color us, EvalState& evalState, std::vector<EvalDelta>& evalStack);
+// Writes the delta into a slot the caller owns, the search keeps one per ply
+void updateEval(GameState& gameState, Move move, Color us, EvalState& evalState, EvalDelta& evalDelta);
 void applyEvalDelta(EvalState& evalState, EvalDelta& evalDelta);
 void undoEvalUpdate(EvalState& evalState, std::vector<EvalDelta>& evalStack);
+void undoEvalUpdate(EvalState& evalState, const EvalDelta& evalDelta);
 int16 getEval(EvalState& eval, Color us);
 
 void updatePawnScore(GameState& gameState, EvalDelta& eval, Move move, Color us, bool captured=false);
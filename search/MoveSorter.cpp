@@ -4,6 +4,7 @@
 
 #include "../movegen/MoveGen.h"
 #include "Common.h"
+#include "Search.h"
 
 // TODO: Fix this.
 void printMovesAndScores(GameState& gameState) {
@@ -23,18 +24,102 @@ void printMovesAndScores(GameState& gameState) {
 	std::cout << "Best Move: " << move.moveToString() << std::endl;
 }
 
+int16 staticExchangeEvaluation(const GameState& gameState, Move move) {
+	if (move.isKingSideCastle() || move.isQueenSideCastle()) return 0;
+
+	uint8 from = move.getStartSquare();
+	uint8 to = move.getTargetSquare();
+	Piece movedPiece = gameState.pieceAt(from);
+	Color side = isWhite(movedPiece) ? Black : White;
+
+	Bitboard occupied = gameState.bitboards[AllIndex] ^ (1ULL << from);
+	std::array<int16, 32> gain;
+	if (move.isEnPassant()) {
+		occupied ^= 1ULL << (side == Black ? to - 8 : to + 8);
+		gain[0] = SEE_PIECE_VALUES[WPawn];
+	}
+	else {
+		Piece capturedPiece = gameState.pieceAt(to);
+		gain[0] = capturedPiece == EMPTY ? 0 : SEE_PIECE_VALUES[capturedPiece];
+	}
+
+	int16 onSquare = SEE_PIECE_VALUES[movedPiece];
+	if (move.isPromotion()) {
+		Piece promoted = move.isQueenPromotion() ? WQueen : move.isRookPromotion() ? WRook : move.isBishopPromotion() ? WBishop : WKnight;
+		gain[0] += SEE_PIECE_VALUES[promoted] - SEE_PIECE_VALUES[WPawn];
+		onSquare = SEE_PIECE_VALUES[promoted];
+	}
+
+	uint8 d = 0;
+	while (d < gain.size() - 1) {
+		Bitboard attackers = getAttackersTo(gameState, to, occupied);
+		Bitboard ours = attackers & gameState.bitboards[side == White ? WhiteIndex : BlackIndex];
+		if (!ours) break;
+
+		// Least valuable attacker first
+		Piece first = side == White ? WPawn : BPawn;
+		Piece attacker = first;
+		while (!(ours & gameState.bitboards[attacker])) attacker = (Piece)(attacker + 1);
+
+		// The king may only recapture onto an undefended square
+		if (attacker == first + 5 && (attackers & ~ours)) break;
+
+		d++;
+		gain[d] = onSquare - gain[d-1];
+		occupied ^= 1ULL << __builtin_ctzll(ours & gameState.bitboards[attacker]);
+		onSquare = SEE_PIECE_VALUES[attacker];
+		side = side == White ? Black : White;
+	}
+
+	// Either side may stop capturing, so every step keeps the better of standing pat and going on
+	while (d > 0) {
+		gain[d-1] = -std::max((int16)-gain[d-1], gain[d]);
+		d--;
+	}
+	return gain[0];
+}
+
+// Promotions by piece, captures by MVV-LVA. Captures that lose material by SEE go below the quiets.
+static uint16 scoreTacticalMove(GameState& state, Move move) {
+	if (move.isPromotion()) {
+		uint16 promoRank = (move.isQueenPromotion() ? 3 : move.isRookPromotion() ? 2: move.isBishopPromotion() ? 1 : 0);
+		return PROMOTION_BASE + PROMO_STEP * promoRank;
+	}
+
+	Piece movedPiece = state.pieceAt(move.getStartSquare());
+	Piece capturedPiece = state.pieceAt(move.getTargetSquare());
+	if (move.isEnPassant()) capturedPiece = state.colorToMove == White ? BPawn : WPawn;
+
+	uint16 mvv = STANDARD_PIECE_VALUES[capturedPiece];
+	uint16 lva = STANDARD_PIECE_VALUES[movedPiece];
+	// Taking an equal or bigger piece never loses material, only the rest needs the exchange played out
+	bool good = mvv >= lva || staticExchangeEvaluation(state, move) >= 0;
+	uint16 BASE = good ? GOOD_CAPTURE_BASE : BAD_CAPTURE_BASE;
+
+	return BASE + MVV_WEIGHT * (mvv * 16 - lva);
+}
+
+static uint16 scoreQuietMove(GameState& state, Move move, HistoryTable& historyTable, CounterHistoryTable& cHistoryTable, FollowUpHistoryTable& fHistoryTable,
+			     ContEntry e, ContEntry e2) {
+	uint8 from = move.getStartSquare();
+	uint8 to = move.getTargetSquare();
+	Piece p = state.pieceAt(from);
+	int16 score = QUIET_BASE + historyTable.getScore(state.colorToMove, from, to);
+	score += cHistoryTable.getScore(e, p, to);
+	score += fHistoryTable.getScore(e2, p, to);
+	return score;
+}
+
 void scoreMoves(GameState& state, MoveList& moves, PickMoveContext& context, HistoryTable& historyTable, CounterHistoryTable& cHistoryTable, FollowUpHistoryTable& fHistoryTable,
-		CounterMoveTable& counterTable, FollowUpMoveTable& followUpTable, ContinuationStack& contStack) {
+		CounterMoveTable& counterTable, FollowUpMoveTable& followUpTable, SearchStack& searchStack) {
 	ContEntry e;
 	ContEntry e2;
-	if (contStack.at(0, e) < 0) e = {0,0};
-	if (contStack.at(1, e2) < 0) e2 = {0,0}; 
-	Move counterMove = counterTable.getMove(contStack);
-	Move followUpMove = followUpTable.getMove(contStack); 
+	if (searchStack.at(0, e) < 0) e = {0,0};
+	if (searchStack.at(1, e2) < 0) e2 = {0,0}; 
+	Move counterMove = counterTable.getMove(searchStack);
+	Move followUpMove = followUpTable.getMove(searchStack); 
 	for (uint16 i = 0; i < context.size; i++) {
 		Move move = moves.list[i];
-		uint8 from = move.getStartSquare();
-		uint8 to = move.getTargetSquare();
 
 		if (move.val == context.pvMove.val) {
 			context.scores.push(PV_MOVE_SCORE); 
@@ -44,22 +129,8 @@ void scoreMoves(GameState& state, MoveList& moves, PickMoveContext& context, His
 			context.scores.push(TT_MOVE_SCORE);
 			continue;
 		}
-		else if (move.isPromotion()) {
-			uint16 promoRank = (move.isQueenPromotion() ? 3 : move.isRookPromotion() ? 2: move.isBishopPromotion() ? 1 : 0);
-			context.scores.push(PROMOTION_BASE + PROMO_STEP * promoRank);
-			continue;
-		}
-		else if (move.isCapture()) {
-			Piece movedPiece = state.pieceAt(from);
-			Piece capturedPiece = state.pieceAt(to);
-			if (move.isEnPassant()) capturedPiece = state.colorToMove == White ? BPawn : WPawn;
-
-			uint16 mvv = STANDARD_PIECE_VALUES[capturedPiece];
-			uint16 lva = STANDARD_PIECE_VALUES[movedPiece];
-			bool good = (int8)mvv - (int8)lva >= 0;
-			uint16 BASE = good ? GOOD_CAPTURE_BASE : BAD_CAPTURE_BASE;
-
-			context.scores.push(BASE + MVV_WEIGHT * (mvv * 16 - lva));
+		else if (move.isPromotion() || move.isCapture()) {
+			context.scores.push(scoreTacticalMove(state, move));
 			continue;
 		}
 		else {
@@ -76,11 +147,7 @@ void scoreMoves(GameState& state, MoveList& moves, PickMoveContext& context, His
 				context.scores.push(KILLER_MOVE_2_SCORE);
 			}
 			else {
-				Piece p = state.pieceAt(from);
-				int16 score = QUIET_BASE + historyTable.getScore(state.colorToMove, from, to);
-				score += cHistoryTable.getScore(e, p, to);
-				score += fHistoryTable.getScore(e2, p, to);
-				context.scores.push(score);
+				context.scores.push(scoreQuietMove(state, move, historyTable, cHistoryTable, fHistoryTable, e, e2));
 			}
 			continue;
 		}
@@ -103,3 +170,190 @@ Move pickMove(MoveList& moves, PickMoveContext& context) {
 	return moves.list[context.start++];
 }
 
+MovePicker::MovePicker(GameState& gameState, MoveList& moves, ScoreList& scores, Move pvMove, Move ttMove, MTEntry killers, bool isCheck,
+		       HistoryTable& historyTable, CounterHistoryTable& cHistoryTable, FollowUpHistoryTable& fHistoryTable,
+		       CounterMoveTable& counterTable, FollowUpMoveTable& followUpTable, SearchStack& searchStack)
+	: gameState(gameState), moves(moves), scores(scores), historyTable(historyTable), cHistoryTable(cHistoryTable), fHistoryTable(fHistoryTable),
+	  counterTable(counterTable), followUpTable(followUpTable), searchStack(searchStack), pvMove(pvMove), ttMove(ttMove), killers(killers) {
+	moves.clear();
+	scores.clear();
+	if (isCheck) {
+		stage = StageGenEvasions;
+		return;
+	}
+	stage = StagePV;
+	counterMove = counterTable.getMove(searchStack);
+	followUpMove = followUpTable.getMove(searchStack);
+}
+
+bool MovePicker::wasTried(Move move) {
+	for (uint8 i = 0; i < triedCount; i++) {
+		if (tried[i].val == move.val) return true;
+	}
+	return false;
+}
+
+// Drops the moves from index from on that were already handed out before generation
+void MovePicker::removeTried(uint16 from) {
+	for (uint16 i = from; i < moves.back; i++) {
+		if (!wasTried(moves.list[i])) continue;
+		moves.back--;
+		moves.list[i] = moves.list[moves.back];
+		scores.list[i] = scores.list[moves.back];
+		i--;
+	}
+	scores.back = moves.back;
+}
+
+// Selection sort step over [current, end), NULL_MOVE if the range is empty or its best score is below minScore
+Move MovePicker::selectBest(uint16 minScore) {
+	if (current >= end) return NULL_MOVE;
+
+	uint16 maxIndex = current;
+	for (uint16 i = current + 1; i < end; i++) {
+		if (scores.list[i] > scores.list[maxIndex]) maxIndex = i;
+	}
+	if (scores.list[maxIndex] < minScore) return NULL_MOVE;
+
+	std::swap(moves.list[current], moves.list[maxIndex]);
+	std::swap(scores.list[current], scores.list[maxIndex]);
+	score = scores.list[current];
+	return moves.list[current++];
+}
+
+template <typename Instrumentation>
+Move MovePicker::next(Instrumentation& instrumentation) {
+	auto isValid = [&](Move move) {
+		return !move.isNull() && !wasTried(move) && isPseudoLegal(gameState, move) && isLegal(gameState, move);
+	};
+	// Killers, counter and follow up moves only stand in for quiets, promotions keep their own score
+	auto isValidRefutation = [&](Move move) {
+		return !move.isCapture() && !move.isPromotion() && isValid(move);
+	};
+	auto hand = [&](Move move, uint16 moveScore) {
+		tried[triedCount++] = move;
+		generated++;
+		score = moveScore;
+		return move;
+	};
+
+	while (true) {
+		Move move;
+		switch (stage) {
+		case StagePV:
+			stage = StageTT;
+			if (isValid(pvMove)) return hand(pvMove, PV_MOVE_SCORE);
+			break;
+		case StageTT:
+			stage = StageGenCaptures;
+			if (isValid(ttMove)) return hand(ttMove, TT_MOVE_SCORE);
+			break;
+		case StageGenCaptures:
+			instrumentation.startTimer();
+			generateAllCaptureMoves(gameState, moves, gameState.colorToMove, checkMask, pinnedPieces, pinnedRays);
+			instrumentation.stopTimer(&SearchTimes::moveGeneration);
+
+			instrumentation.startTimer();
+			for (uint16 i = 0; i < moves.back; i++) scores.list[i] = scoreTacticalMove(gameState, moves.list[i]);
+			removeTried(0);
+			instrumentation.stopTimer(&SearchTimes::moveScoring);
+
+			current = 0;
+			end = moves.back;
+			generated += end;
+			stage = StageGoodCaptures;
+			break;
+		case StageGoodCaptures:
+			instrumentation.startTimer();
+			move = selectBest(GOOD_CAPTURE_BASE);
+			instrumentation.stopTimer(&SearchTimes::movePicking);
+			if (!move.isNull()) return move;
+			badCaptureStart = current;
+			badCaptureEnd = end;
+			stage = StageKiller1;
+			break;
+		case StageKiller1:
+			stage = StageCounter;
+			if (isValidRefutation(killers.move1)) return hand(killers.move1, KILLER_MOVE_1_SCORE);
+			break;
+		case StageCounter:
+			stage = StageFollowUp;
+			if (isValidRefutation(counterMove)) return hand(counterMove, COUNTER_MOVE_SCORE);
+			break;
+		case StageFollowUp:
+			stage = StageKiller2;
+			if (isValidRefutation(followUpMove)) return hand(followUpMove, FOLLOW_UP_MOVE_SCORE);
+			break;
+		case StageKiller2:
+			stage = StageGenQuiets;
+			if (isValidRefutation(killers.move2)) return hand(killers.move2, KILLER_MOVE_2_SCORE);
+			break;
+		case StageGenQuiets: {
+			instrumentation.startTimer();
+			generateAllQuietMoves(gameState, moves, gameState.colorToMove, checkMask, pinnedPieces, pinnedRays);
+			instrumentation.stopTimer(&SearchTimes::moveGeneration);
+
+			instrumentation.startTimer();
+			ContEntry e;
+			ContEntry e2;
+			if (searchStack.at(0, e) < 0) e = {0,0};
+			if (searchStack.at(1, e2) < 0) e2 = {0,0};
+			for (uint16 i = badCaptureEnd; i < moves.back; i++) {
+				Move quiet = moves.list[i];
+				scores.list[i] = quiet.isPromotion() ? scoreTacticalMove(gameState, quiet)
+								     : scoreQuietMove(gameState, quiet, historyTable, cHistoryTable, fHistoryTable, e, e2);
+			}
+			removeTried(badCaptureEnd);
+			instrumentation.stopTimer(&SearchTimes::moveScoring);
+
+			current = badCaptureEnd;
+			end = moves.back;
+			generated += end - current;
+			stage = StageQuiets;
+		} break;
+		case StageQuiets:
+			instrumentation.startTimer();
+			move = selectBest(0);
+			instrumentation.stopTimer(&SearchTimes::movePicking);
+			if (!move.isNull()) return move;
+			current = badCaptureStart;
+			end = badCaptureEnd;
+			stage = StageBadCaptures;
+			break;
+		case StageBadCaptures:
+			instrumentation.startTimer();
+			move = selectBest(0);
+			instrumentation.stopTimer(&SearchTimes::movePicking);
+			if (!move.isNull()) return move;
+			stage = StageDone;
+			break;
+		case StageGenEvasions: {
+			instrumentation.startTimer();
+			generateAllMoves(gameState, moves, gameState.colorToMove);
+			instrumentation.stopTimer(&SearchTimes::moveGeneration);
+
+			instrumentation.startTimer();
+			PickMoveContext context = {scores, pvMove, ttMove, killers, 0, moves.back};
+			scoreMoves(gameState, moves, context, historyTable, cHistoryTable, fHistoryTable, counterTable, followUpTable, searchStack);
+			instrumentation.stopTimer(&SearchTimes::moveScoring);
+
+			current = 0;
+			end = moves.back;
+			generated = end;
+			stage = StageEvasions;
+		} break;
+		case StageEvasions:
+			instrumentation.startTimer();
+			move = selectBest(0);
+			instrumentation.stopTimer(&SearchTimes::movePicking);
+			if (!move.isNull()) return move;
+			stage = StageDone;
+			break;
+		case StageDone:
+			return NULL_MOVE;
+		}
+	}
+}
+
+template Move MovePicker::next<SearchInstrumentation>(SearchInstrumentation& instrumentation);
+template Move MovePicker::next<NoInstrumentation>(NoInstrumentation& instrumentation);
@@ -2,6 +2,8 @@
 #include <vector>
 
 #include "../chess/GameState.h"
+#include "../helpers/LargePages.h"
+#include "SearchStack.h"
 #include "Common.h"
 #include "Move.h"
 
@@ -31,49 +33,11 @@ constexpr uint16 BAD_CAPTURE_BASE = 20000;
 
 constexpr uint16 LOWEST_BASE = 10000;
 
-constexpr uint8 MOVE_TABLE_SIZE   = 30;
-constexpr uint8 CONTINUATION_SIZE = 4;
-
-
-typedef struct ContEntry {
-	Piece p;
-	uint8 to;
-} ContEntry;
-
-typedef struct ContinuationStack {
-	std::vector<ContEntry> stack;
-
-	ContinuationStack() { stack.reserve(256); }
-
-	void push(Piece p, uint8 to) { stack.push_back({p, to}); }
-	void push(GameState& s, Move m) { stack.push_back({s.pieceAt(m.getStartSquare()), (uint8)m.getTargetSquare()}); }
-
-	void pop() { stack.pop_back(); }
+// Centipawn values for the static exchange evaluation. The king is never captured, so its value only
+// has to be larger than anything it could win.
+constexpr int16 SEE_PIECE_VALUES[12] = {100, 300, 300, 500, 900, 20000, 100, 300, 300, 500, 900, 20000};
 
-	int8 at(uint8 lag, ContEntry& e) { 
-		uint8 s = stack.size();
-		if (lag >= s) return -1;
-		e = stack[stack.size() - 1 - lag]; 
-		return 0;
-	}
-
-} ContinuationStack;
-
-typedef struct ScoreList {
-	std::array<uint16, MAX_MOVE_COUNT> list;
-	uint16 back = 0;
-
-	inline void clear() { back = 0; }
-	inline void push(uint16 score) { assert(back < MAX_MOVE_COUNT); list[back++] = score; }
-	inline bool isEmpty() { return back == 0; }
-	inline uint16* begin() { return &list[0]; }
-	inline uint16* end() { return &list[back]; }
-} ScoreList;
-
-typedef struct MTEntry {
-	Move move1;
-	Move move2;
-} MTEntry;
+constexpr uint8 CONTINUATION_SIZE = 4;
 
 typedef struct PickMoveContext {
 	ScoreList& scores;
@@ -84,23 +48,6 @@ typedef struct PickMoveContext {
 	uint16 size;
 } PickMoveContext;
 
-typedef struct MoveTable {
-	std::array<MTEntry, MOVE_TABLE_SIZE> table;
-	MoveTable() { clearTable(); }
-
-	inline void clearTable() { for (uint8 i = 0; i < MOVE_TABLE_SIZE; i++) table[i] = {NULL_MOVE, NULL_MOVE}; }
-
-	inline MTEntry& getEntry(uint8 pliesFromRoot) { return table[pliesFromRoot]; }
-	
-	inline void storeEntry(uint8 pliesFromRoot, Move move) { 
-		MTEntry& e = table[pliesFromRoot];
-		if (e.move1.val != move.val) {
-			e.move2 = e.move1;
-			e.move1 = move;
-		}
-	}	
-} MoveTable;
-
 typedef struct HistoryTable {
 	std::array<std::array<std::array<int16, 64>, 64>, 2> table;
 
@@ -139,15 +86,15 @@ typedef struct CounterMoveTable {
 		}
 	}
 
-	inline void addMove(Move m, ContinuationStack& cS) {
+	inline void addMove(Move m, const SearchStack& ss) {
 		ContEntry e;
-		if (cS.at(0, e) < 0) return;
+		if (ss.at(0, e) < 0) return;
 		table[e.p][e.to] = m;
 	}
 
-	inline Move getMove(ContinuationStack& cS) { 
+	inline Move getMove(const SearchStack& ss) { 
 		ContEntry e;
-		if (cS.at(0, e) < 0) return NULL_MOVE;
+		if (ss.at(0, e) < 0) return NULL_MOVE;
 		return table[e.p][e.to];
 	}
 
@@ -166,88 +113,117 @@ typedef struct FollowUpMoveTable{
 		}
 	}
 
-	inline void addMove(Move m, ContinuationStack& cS) {
+	inline void addMove(Move m, const SearchStack& ss) {
 		ContEntry e;
-		if (cS.at(1, e) < 0) return;
+		if (ss.at(1, e) < 0) return;
 		table[e.p][e.to] = m;
 	}
 
-	inline Move getMove(ContinuationStack& cS) { 
+	inline Move getMove(const SearchStack& ss) { 
 		ContEntry e;
-		if (cS.at(1, e) < 0) return NULL_MOVE;
+		if (ss.at(1, e) < 0) return NULL_MOVE;
 		return table[e.p][e.to];
 	}
 
 } FollowUpMoveTable;
 
+// Indexed [previous piece][previous to][piece][to], ~1.2MB so it is backed by huge pages when available.
+// The allocation comes zeroed and is faulted in on first use, so constructing a worker stays cheap.
+typedef std::array<std::array<std::array<std::array<int16, 64>, 12>, 64>, 12> ContinuationHistory;
+
+// Falls back to a zeroed heap block when no mapping can be made, mappedBytes stays 0 for it
+inline ContinuationHistory* allocContinuationHistory(LargePageMode& mode, uint64& mappedBytes) {
+	void* block = allocLargePages(sizeof(ContinuationHistory), mode, mappedBytes);
+	if (block) return static_cast<ContinuationHistory*>(block);
+	mappedBytes = 0;
+	return new ContinuationHistory{};
+}
+
+inline void freeContinuationHistory(ContinuationHistory* table, uint64 mappedBytes) {
+	if (mappedBytes == 0) delete table;
+	else freeLargePages(table, mappedBytes);
+}
+
 typedef struct CounterHistoryTable{
-	std::array<std::array<std::array<std::array<int16, 64>, 12>, 64>, 12> table;
+	LargePageMode pageMode = PagesNormal;
+	uint64 mappedBytes = 0;
+	ContinuationHistory* table;
+
+	CounterHistoryTable() : table(allocContinuationHistory(pageMode, mappedBytes)) {}
+	~CounterHistoryTable() { freeContinuationHistory(table, mappedBytes); }
 
-	CounterHistoryTable() { clearTable(); }
+	CounterHistoryTable(const CounterHistoryTable&) = delete;
+	CounterHistoryTable& operator=(const CounterHistoryTable&) = delete;
 
 	inline void clearTable() { 
 		for (uint8 p1 = 0; p1 < PIECE_COUNT; p1++) {
 			for (uint8 to1 = 0; to1 < 64; to1++) {
 				for (uint8 p2 = 0; p2 < PIECE_COUNT; p2++) {
 					for (uint8 to2 = 0; to2 < 64; to2++) {
-						table[p1][to1][p2][to2] = 0;
+						(*table)[p1][to1][p2][to2] = 0;
 					}
 				}
 			}
 		}
 	}
 
-	inline void update(Piece p, uint8 to, int16 bonus, ContinuationStack& cS) { 
+	inline void update(Piece p, uint8 to, int16 bonus, const SearchStack& ss) { 
 		ContEntry e;
-		if (cS.at(0, e) < 0) return;
+		if (ss.at(0, e) < 0) return;
 		int16 clampedBonus = bonus < -MAX_COUNTER_BONUS ? -MAX_COUNTER_BONUS : bonus > MAX_COUNTER_BONUS ? MAX_COUNTER_BONUS : bonus;
-		table[e.p][e.to][p][to] += clampedBonus - table[e.p][e.to][p][to] * abs(clampedBonus) / MAX_COUNTER_BONUS;
+		(*table)[e.p][e.to][p][to] += clampedBonus - (*table)[e.p][e.to][p][to] * abs(clampedBonus) / MAX_COUNTER_BONUS;
 	}
 
 	inline int16 getScore(ContEntry e, Piece p, uint8 to) {
-		return table[e.p][e.to][p][to];
+		return (*table)[e.p][e.to][p][to];
 	}
 
-	inline int16 getScore(Piece p, uint8 to, ContinuationStack cs) {
+	inline int16 getScore(Piece p, uint8 to, const SearchStack& ss) {
 		ContEntry e;
-		if (cs.at(1, e) < 0) return 0;
-		return table[e.p][e.to][p][to];
+		if (ss.at(1, e) < 0) return 0;
+		return (*table)[e.p][e.to][p][to];
 	}
 
 } CounterHistoryTable;
 
 typedef struct FollowUpHistoryTable{
-	std::array<std::array<std::array<std::array<int16, 64>, 12>, 64>, 12> table;
+	LargePageMode pageMode = PagesNormal;
+	uint64 mappedBytes = 0;
+	ContinuationHistory* table;
 
-	FollowUpHistoryTable() { clearTable(); }
+	FollowUpHistoryTable() : table(allocContinuationHistory(pageMode, mappedBytes)) {}
+	~FollowUpHistoryTable() { freeContinuationHistory(table, mappedBytes); }
+
+	FollowUpHistoryTable(const FollowUpHistoryTable&) = delete;
+	FollowUpHistoryTable& operator=(const FollowUpHistoryTable&) = delete;
 
 	inline void clearTable() { 
 		for (uint8 p1 = 0; p1 < PIECE_COUNT; p1++) {
 			for (uint8 to1 = 0; to1 < 64; to1++) {
 				for (uint8 p2 = 0; p2 < PIECE_COUNT; p2++) {
 					for (uint8 to2 = 0; to2 < 64; to2++) {
-						table[p1][to1][p2][to2] = 0;
+						(*table)[p1][to1][p2][to2] = 0;
 					}
 				}
 			}
 		}
 	}
 
-	inline void update(Piece p, uint8 to, int16 bonus, ContinuationStack& cS) { 
+	inline void update(Piece p, uint8 to, int16 bonus, const SearchStack& ss) { 
 		ContEntry e;
-		if (cS.at(1, e) < 0) return;
+		if (ss.at(1, e) < 0) return;
 		int16 clampedBonus = bonus < -MAX_FOLLOW_UP_BONUS ? -MAX_FOLLOW_UP_BONUS : bonus > MAX_FOLLOW_UP_BONUS ? MAX_FOLLOW_UP_BONUS : bonus;
-		table[e.p][e.to][p][to] += clampedBonus - table[e.p][e.to][p][to] * abs(clampedBonus) / MAX_FOLLOW_UP_BONUS;
+		(*table)[e.p][e.to][p][to] += clampedBonus - (*table)[e.p][e.to][p][to] * abs(clampedBonus) / MAX_FOLLOW_UP_BONUS;
 	}
 
 	inline int16 getScore(ContEntry e, Piece p, uint8 to) {
-		return table[e.p][e.to][p][to];
+		return (*table)[e.p][e.to][p][to];
 	}
 
-	inline int16 getScore(Piece p, uint8 to, ContinuationStack cs) {
+	inline int16 getScore(Piece p, uint8 to, const SearchStack& ss) {
 		ContEntry e;
-		if (cs.at(1, e) < 0) return 0;
-		return table[e.p][e.to][p][to];
+		if (ss.at(1, e) < 0) return 0;
+		return (*table)[e.p][e.to][p][to];
 	}
 
 } FollowUpHistoryTable;
@@ -287,10 +263,72 @@ typedef struct FollowUpHistoryTable{
 // 	}
 // } ContinuationTable;
 
+enum PickStage : uint8 {
+	StagePV, StageTT, StageGenCaptures, StageGoodCaptures, StageKiller1, StageCounter, StageFollowUp, StageKiller2,
+	StageGenQuiets, StageQuiets, StageBadCaptures, StageGenEvasions, StageEvasions, StageDone
+};
+
+// Hands out the moves of one node in stages: PV and TT move, good captures, killers and counter moves, quiets,
+// bad captures. Quiets are only generated and scored once everything before them failed to cut off.
+// Moves that do not come from the generator are checked with isPseudoLegal and isLegal first.
+// In check all evasions are generated and scored at once, there are only a few of them.
+typedef struct MovePicker {
+	GameState& gameState;
+	MoveList& moves;
+	ScoreList& scores;
+	HistoryTable& historyTable;
+	CounterHistoryTable& cHistoryTable;
+	FollowUpHistoryTable& fHistoryTable;
+	CounterMoveTable& counterTable;
+	FollowUpMoveTable& followUpTable;
+	SearchStack& searchStack;
+
+	Move pvMove;
+	Move ttMove;
+	MTEntry killers;
+	Move counterMove = NULL_MOVE;
+	Move followUpMove = NULL_MOVE;
+
+	PickStage stage;
+	uint16 current = 0;
+	uint16 end = 0;
+	uint16 badCaptureStart = 0;
+	uint16 badCaptureEnd = 0;
+
+	// Moves handed out before generation, skipped once the generated lists contain them
+	std::array<Move, 6> tried;
+	uint8 triedCount = 0;
+
+	Bitboard checkMask = 0;
+	Bitboard pinnedPieces = 0;
+	std::array<Bitboard, 64> pinnedRays;
+
+	// Score of the move next() returned last, in the same scale as scoreMoves
+	uint16 score = 0;
+	// Moves generated or validated so far
+	uint16 generated = 0;
+
+	MovePicker(GameState& gameState, MoveList& moves, ScoreList& scores, Move pvMove, Move ttMove, MTEntry killers, bool isCheck,
+		   HistoryTable& historyTable, CounterHistoryTable& cHistoryTable, FollowUpHistoryTable& fHistoryTable,
+		   CounterMoveTable& counterTable, FollowUpMoveTable& followUpTable, SearchStack& searchStack);
+
+	// Returns NULL_MOVE once every legal move was handed out. Instantiated for the search instrumentation policies.
+	template <typename Instrumentation>
+	Move next(Instrumentation& instrumentation);
+
+	bool wasTried(Move move);
+	void removeTried(uint16 from);
+	Move selectBest(uint16 minScore);
+} MovePicker;
+
+// Material balance for the side to move after all captures on the target square of move,
+// each side capturing with its least valuable attacker and stopping once recapturing loses
+int16 staticExchangeEvaluation(const GameState& gameState, Move move);
+
 void printMovesAndScores(GameState& gameState);
 
 void scoreMoves(GameState& gameState, MoveList& moves, PickMoveContext& context, HistoryTable& historyTable, CounterHistoryTable& cHistoryTable, FollowUpHistoryTable& fHistoryTable,
-		CounterMoveTable& counterTable, FollowUpMoveTable& followUpTable, ContinuationStack& moveStack);
+		CounterMoveTable& counterTable, FollowUpMoveTable& followUpTable, SearchStack& searchStack);
 
 Move pickMove(MoveList& moves, PickMoveContext& context);
 
@@ -1,7 +1,13 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cassert>
 #include <cstddef>
 #include <iostream>
 #include <math.h>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <vector>
 
 #include "Search.h"
@@ -10,6 +16,7 @@
 #include "Evaluation.h"
 #include "Move.h"
 #include "MoveSorter.h"
+#include "TimeManager.h"
 #include "TranspositionTable.h"
 #include "../chess/GameState.h"
 #include "../chess/GameRules.h"
@@ -17,26 +24,17 @@
 #include "../helpers/Timer.h"
 #include "../movegen/MoveGen.h"
 
+// Every worker shares the TT, all other search state lives in the workers themselves
 TranspositionTable g_TranspositionTable;
-MoveTable g_MoveTable;
-HistoryTable g_HistoryTable;
-CounterHistoryTable g_CHistoryTable;
-FollowUpHistoryTable g_FHistoryTable;
+std::atomic<bool> g_StopSearch{false};
+SearchWorker g_MainWorker(g_TranspositionTable, g_StopSearch);
 
-CounterMoveTable g_CounterMoveTable;
-FollowUpMoveTable g_FollowUpMoveTable;
+uint16 g_ThreadCount = 1;
+// Helper workers live from one search to the next, so their history, killer and counter move tables carry over like the main worker's
+std::vector<std::unique_ptr<SearchWorker>> g_HelperWorkers;
+std::vector<std::thread> g_HelperThreads;
 
-RepetitionTable g_GameRepetitionHistory;
-RepetitionTable g_SearchRepetitionStack;
-ContinuationStack g_ContStack;
-std::vector<EvalDelta> g_EvalStack;
-
-MovePool g_MovePool;
-MoveScorePool g_ScoreMovePool;
-QuiescencePool g_QuiescencePool;
-MoveScorePool g_ScoreQuiesencePool;
-
-uint64 g_StartTime = 0;
+std::mutex g_OutputMutex;
 
 #include <iomanip>
 #include <sstream>
@@ -56,11 +54,77 @@ uint64 g_StartTime = 0;
 #define SEP "──────────────────────────────────────────────────────────\n"
 #endif
 
-void clearTranspositionTable() { g_TranspositionTable.clearTable(); }
+void printLine(const std::string& line) {
+	std::lock_guard<std::mutex> lock(g_OutputMutex);
+	std::cout << line << std::endl;
+}
+
+void clearTranspositionTable() { g_TranspositionTable.requestClear(); }
+
+void resizeTranspositionTable(uint64 sizeMB) { g_TranspositionTable.resize(sizeMB); }
+
+bool prepareSearchTables() { return g_TranspositionTable.prepare(); }
+
+bool saveTranspositionTable(const std::string& path) {
+	g_TranspositionTable.prepare();
+	return g_TranspositionTable.saveSnapshot(path);
+}
+
+bool loadTranspositionTable(const std::string& path) { return g_TranspositionTable.loadSnapshot(path); }
+
+void setSearchThreads(uint16 threads) {
+	g_ThreadCount = std::clamp<uint16>(threads, 1, MAX_SEARCH_THREADS);
+	g_HelperWorkers.resize(g_ThreadCount - 1);
+	for (std::unique_ptr<SearchWorker>& worker : g_HelperWorkers) {
+		if (!worker) worker = std::make_unique<SearchWorker>(g_TranspositionTable, g_StopSearch);
+	}
+}
+
+void setMoveOverhead(uint64 ms) { g_MainWorker.moveOverhead = std::min(ms, MAX_MOVE_OVERHEAD_MS); }
+
+void setMultiPV(uint16 lines) { g_MainWorker.multiPV = std::clamp<uint16>(lines, 1, MAX_MULTI_PV); }
+
+uint64 SearchWorker::searchedNodes() const {
+	uint64 total = nodes.load(std::memory_order_relaxed);
+	if (this == &g_MainWorker) {
+		for (const std::unique_ptr<SearchWorker>& worker : g_HelperWorkers) total += worker->nodes.load(std::memory_order_relaxed);
+	}
+	return total;
+}
+
+void clearHistoryTables() {
+	g_MainWorker.clearHistoryTables();
+	for (std::unique_ptr<SearchWorker>& worker : g_HelperWorkers) worker->clearHistoryTables();
+}
+
+void SearchWorker::clearHistoryTables() {
+	searchStack.clearKillers();
+	historyTable.clearTable();
+	cHistoryTable.clearTable();
+	fHistoryTable.clearTable();
+	counterMoveTable.clearTable();
+	followUpMoveTable.clearTable();
+}
+
+std::string getLargePageReport() {
+	return std::string("pages tt ") + largePageModeName(g_TranspositionTable.pageMode) +
+		" counterhistory " + largePageModeName(g_MainWorker.cHistoryTable.pageMode) +
+		" followuphistory " + largePageModeName(g_MainWorker.fHistoryTable.pageMode);
+}
+
+static bool hasNonPawnMaterial(const GameState& gameState, Color us) {
+	const Bitboard* bb = gameState.bitboards.data();
+	if (us == White) return bb[WKnight] | bb[WBishop] | bb[WRook] | bb[WQueen];
+	return bb[BKnight] | bb[BBishop] | bb[BRook] | bb[BQueen];
+}
+
+int16 SearchWorker::quiescenceSearch(GameState& gameState, EvalState& evalState, std::vector<MoveInfo>& history, SearchContext& context, Move pvMove,
+				     int16 alpha, int16 beta, uint8 pliesFromRoot, uint8 pliesRemaining) {
+	countNode();
+	context.selDepth = std::max(context.selDepth, pliesFromRoot);
 
-int16 quiescenceSearch(GameState& gameState, EvalState& evalState, std::vector<MoveInfo>& history, Move pvMove, int16 alpha, int16 beta, uint8 pliesFromRoot, uint8 pliesRemaining) {
 	int16 staticEval = getEval(evalState, gameState.colorToMove);
-	if (pliesFromRoot >= 5) return staticEval;
+	if (pliesRemaining == 0) return staticEval;
 
 	bool isCheck = isSquareAttacked(gameState, gameState.bitboards[gameState.colorToMove == White ? WKing : BKing], gameState.colorToMove == White ? Black : White);
 
@@ -70,46 +134,54 @@ int16 quiescenceSearch(GameState& gameState, EvalState& evalState, std::vector<M
 		if (bestEval > alpha) alpha = bestEval;
 	}
 
-	Entry entry = g_TranspositionTable.table[g_TranspositionTable.index(gameState.zobristHash)];
-	if (gameState.zobristHash == entry.zobrist && entry.score != SCORE_SENTINAL && entry.depth == 0) {
-		if (entry.nodeType == LowerBound && entry.score >= beta) return entry.score;
-		if (entry.nodeType == UpperBound && entry.score <= alpha) return entry.score;
-		if (entry.nodeType == LowerBound) alpha = std::max(alpha, entry.score);
-		else if (entry.nodeType == UpperBound) beta = std::min(beta, entry.score);
+	Entry entry;
+	bool ttHit = tt.probe(gameState.zobristHash, entry);
+	Move ttMove = ttHit ? entry.bestMove : NULL_MOVE;
+	if (ttHit && entry.depth() == 0) {
+		NodeType nodeType = entry.nodeType();
+		if (nodeType == LowerBound && entry.score >= beta) return entry.score;
+		if (nodeType == UpperBound && entry.score <= alpha) return entry.score;
+		if (nodeType == LowerBound) alpha = std::max(alpha, entry.score);
+		else if (nodeType == UpperBound) beta = std::min(beta, entry.score);
 	}
 
-	auto& moves = g_QuiescencePool.getMoveList(pliesFromRoot);
+	MoveList& moves = searchStack[pliesFromRoot].moves;
+	moves.clear();
+	searchStack[pliesFromRoot].scores.clear();
 	if (isCheck) generateAllMoves(gameState, moves, gameState.colorToMove);
 	else generateAllCaptureMoves(gameState, moves, gameState.colorToMove);
 
 	uint16 movesSize = moves.back;
 
-	if (movesSize == 0) return isCheck ? NEG_INF + pliesFromRoot : 0;
+	// Without captures the stand pat score is all there is, only in check does no move mean mate
+	if (movesSize == 0) return isCheck ? NEG_INF + pliesFromRoot : alpha;
 
-	PickMoveContext pickMoveContext = {g_ScoreMovePool.getScoreList(pliesFromRoot), pvMove, 
-					   entry.bestMove, g_MoveTable.table[pliesFromRoot], 0, movesSize};
-	scoreMoves(gameState, moves, pickMoveContext, g_HistoryTable, g_CHistoryTable, g_FHistoryTable,
-	    	   g_CounterMoveTable, g_FollowUpMoveTable, g_ContStack);
+	PickMoveContext pickMoveContext = {searchStack[pliesFromRoot].scores, pvMove, 
+					   ttMove, searchStack[pliesFromRoot].killers, 0, movesSize};
+	scoreMoves(gameState, moves, pickMoveContext, historyTable, cHistoryTable, fHistoryTable,
+	    	   counterMoveTable, followUpMoveTable, searchStack);
 	Move bestMoveInThisPos = moves.list[0];
 	int16 originalAlpha = alpha;
 
 	for (uint16 i = 0; i < movesSize; i++) {
 		Move move = pickMove(moves, pickMoveContext);
 	  		assert(move.val != 0);
+		// Captures come best first, so once one loses material by SEE all the remaining ones do too
+		if (!isCheck && pickMoveContext.scores.list[i] < GOOD_CAPTURE_BASE) break;
+		tt.prefetch(gameState.keyAfter(move));
 
-		g_ContStack.push(gameState, move);
-		updateEval(gameState, move, gameState.colorToMove, evalState, g_EvalStack);
+		searchStack.push(gameState, move);
+		updateEval(gameState, move, gameState.colorToMove, evalState, searchStack[pliesFromRoot].evalDelta);
 		gameState.makeMove(move, history);
 
-		int16 score = -quiescenceSearch(gameState, evalState, history, pvMove, -beta, -alpha, pliesFromRoot + 1, pliesRemaining - 1);
+		int16 score = -quiescenceSearch(gameState, evalState, history, context, NULL_MOVE, -beta, -alpha, pliesFromRoot + 1, pliesRemaining - 1);
 
 		gameState.unmakeMove(move, history);
-		undoEvalUpdate(evalState, g_EvalStack);
-		g_ContStack.pop();
+		undoEvalUpdate(evalState, searchStack[pliesFromRoot].evalDelta);
+		searchStack.pop();
 
 		if (score >= beta) {
-			Entry e{gameState.zobristHash, move, score, 0, LowerBound};
-			g_TranspositionTable.storeEntry(e);
+			tt.storeEntry(gameState.zobristHash, move, score, staticEval, 0, LowerBound);
 			return score;
 		}
 		if (score > bestEval) {
@@ -122,82 +194,185 @@ int16 quiescenceSearch(GameState& gameState, EvalState& evalState, std::vector<M
 		}
 	}
 
-	g_TranspositionTable.storeEntry(gameState.zobristHash, bestMoveInThisPos, pliesFromRoot, pliesRemaining, alpha, beta, originalAlpha);
+	tt.storeEntry(gameState.zobristHash, bestMoveInThisPos, pliesFromRoot, 0, alpha, beta, originalAlpha, staticEval);
 
 	return alpha;
 }
 
-Move iterativeDeepeningSearch(GameState& gameState, std::vector<MoveInfo>& history) {
+// Mate scores count plies from the root, UCI wants moves, negative when we are the ones getting mated
+static std::string getUciScore(int16 score) {
+	if (!isMateScore(score)) return "cp " + std::to_string(score);
+	int16 plies = -NEG_INF - std::abs(score);
+	return "mate " + std::to_string(score > 0 ? (plies + 1) / 2 : -(plies / 2));
+}
+
+static std::string getUciInfo(int16 depth, const SearchContext& context, int16 score, const PVLine& pv, uint64 nodes, uint64 hashfull) {
+	uint64 elapsed = getTimeElapsed(context.startTime);
+	uint64 nps = elapsed > 0 ? nodes * 1000 / elapsed : 0;
+
+	std::string info = "info depth " + std::to_string(depth) + " seldepth " + std::to_string(context.selDepth) +
+			   " multipv " + std::to_string(context.pvIndex + 1) + " score " + getUciScore(score) + " nodes " + std::to_string(nodes) + " nps " + std::to_string(nps) +
+			   " time " + std::to_string(elapsed) + " hashfull " + std::to_string(hashfull) + " pv";
+	for (uint8 i = 0; i < pv.length; i++) info += " " + pv.moves[i].moveToString();
+	return info;
+}
+
+static uint64 deadlineAfter(uint64 startTime, uint64 ms) {
+	if (ms == NO_TIME_LIMIT) return NO_TIME_LIMIT;
+	return startTime + ms * cntfrq() / 1000;
+}
+
+template <typename Instrumentation>
+int16 SearchWorker::aspirationSearch(GameState& gameState, EvalState& evalState, std::vector<MoveInfo>& history, SearchContext& context,
+				     int16 previousScore, int16 depth, Instrumentation& instrumentation) {
+	int32 delta = ASPIRATION_WINDOW;
+	int32 alpha = NEG_INF;
+	int32 beta = POS_INF;
+	// Mate scores jump between iterations, a narrow window around one only causes re-searches
+	if (depth >= ASPIRATION_MIN_DEPTH && !isMateScore(previousScore)) {
+		alpha = std::max<int32>(NEG_INF, previousScore - delta);
+		beta = std::min<int32>(POS_INF, previousScore + delta);
+	}
+
+	while (true) {
+		searchRepetitionStack = gameRepetitionHistory;
+		assert(searchStack.height == 0);
+		searchStack[0].followingPV = true;
+		int16 score = alphaBetaSearch<RootNode>(gameState, evalState, history, context, alpha, beta, 0, depth, instrumentation);
+		if (context.searchCanceled) return score;
+
+		// Fail low pulls beta down as well, the true score is below the old window
+		if (score <= alpha && alpha > NEG_INF) {
+			beta = (alpha + beta) / 2;
+			alpha = std::max<int32>(NEG_INF, score - delta);
+			if constexpr (Instrumentation::ENABLED) instrumentation.stats.aspirationFailLows++;
+		}
+		else if (score >= beta && beta < POS_INF) {
+			beta = std::min<int32>(POS_INF, score + delta);
+			if constexpr (Instrumentation::ENABLED) instrumentation.stats.aspirationFailHighs++;
+		}
+		else return score;
+
+		if constexpr (Instrumentation::ENABLED) instrumentation.stats.aspirationResearches++;
+		delta *= ASPIRATION_WIDENING;
+	}
+}
+
+Move SearchWorker::iterativeDeepeningSearch(GameState& gameState, std::vector<MoveInfo>& history, const SearchLimits& limits) {
 	Move bestMove;
 	SearchContext context;
 	context.startTime = cntvct();
+	nodes.store(0, std::memory_order_relaxed);
 	context.searchCanceled = false;
 
-	g_EvalStack.reserve(MAX_PLY);
+	TimeManager timeManager;
+	timeManager.init(limits, gameState.colorToMove, moveOverhead, TIME_PER_MOVE);
+	context.deadline = deadlineAfter(context.startTime, timeManager.hardLimit);
+	context.lastPoll = context.startTime;
+	int16 maxDepth = limits.depth > 0 ? std::min(limits.depth, MAX_SEARCH_DEPTH) : MAX_SEARCH_DEPTH;
+	uint64 lastIteration = 0;
+	uint64 previousIteration = 0;
+
+	// makeMove still appends to the game history, reserving here keeps the search itself free of allocations
+	history.reserve(history.size() + MAX_PLY);
 	EvalState evalState{};
 	initEval(gameState, evalState, gameState.colorToMove);
 
-	if (gameState.halfMoves == 0) g_GameRepetitionHistory.clear();
+	// Never more lines than root moves, every line needs a move of its own
+	MoveList rootMoves;
+	generateAllMoves(gameState, rootMoves, gameState.colorToMove);
+	uint8 lineCount = std::max<uint16>(1, std::min<uint16>(multiPV, rootMoves.back));
+	for (uint8 i = 0; i < lineCount; i++) rootLines[i] = RootLine();
 
 	#ifdef DEBUG_MODE
 	SearchStats stats;
 	SearchTimes times;
+	SearchInstrumentation instrumentation{stats, times};
+	#else
+	NoInstrumentation instrumentation;
 	#endif
 
-	for (int16 depth = 1; depth < 100; depth++) {
-		std::cout << depth << std::endl;
-		g_SearchRepetitionStack = g_GameRepetitionHistory;
-
-		#ifdef DEBUG_MODE
-		alphaBetaSearch(gameState, evalState, history, context, NEG_INF, POS_INF, 0, depth, stats, times);
-		#else
-		alphaBetaSearch(gameState, evalState, history, context, NEG_INF, POS_INF, 0, depth);
-		#endif
+	int16 depth = 1;
+	for (; depth <= maxDepth; depth++) {
+		uint64 iterationStart = cntvct();
+		context.selDepth = 0;
+
+		// One root search per line, each seeded with the PV and score the same line had last iteration
+		for (context.pvIndex = 0; context.pvIndex < lineCount; context.pvIndex++) {
+			RootLine& line = rootLines[context.pvIndex];
+			previousPV = line.pv;
+			int16 lineScore = aspirationSearch(gameState, evalState, history, context, line.score, depth, instrumentation);
+			if (context.searchCanceled) break;
+
+			line.score = lineScore;
+			line.pv = pvTable.rootLine();
+			printLine(getUciInfo(depth, context, line.score, line.pv, searchedNodes(), tt.hashfull()));
+		}
 
+		// Stopped in a later line, the best line of this iteration is complete
 		if (context.searchCanceled) {
-			#ifdef DEBUG_MODE
-			std::cout << "\nSearch stopped due to time limit.\n";
-			uint16 totalTime = getTimeElapsed(context.startTime);
-			times.total = totalTime;
-			printSearchStats(stats, depth, context.bestMoveThisIteration, totalTime, gameState.zobristHash);
-			printSearchTimes(times);
-			#endif
-			if (!context.bestMoveThisIteration.isNull() && bestMove.isNull())
+			if (!context.bestMoveThisIteration.isNull() && (bestMove.isNull() || context.pvIndex > 0))
 				bestMove = context.bestMoveThisIteration;
 			break;
 		}
 		if (!context.bestMoveThisIteration.isNull()) {
 			bestMove = context.bestMoveThisIteration;
 		}
+
+		previousIteration = lastIteration;
+		lastIteration = getTimeElapsed(iterationStart);
+		if (!timeManager.canStartIteration(getTimeElapsed(context.startTime), lastIteration, previousIteration)) break;
 	}
 
+	#ifdef DEBUG_MODE
+	std::cout << "\nSearch stopped " << (context.searchCanceled ? "due to time limit" : "by the time manager") << ".\n";
+	uint16 totalTime = getTimeElapsed(context.startTime);
+	times.total = totalTime;
+	stats.ttHashfull = tt.hashfull();
+	printSearchStats(stats, std::min(depth, maxDepth), context.bestMoveThisIteration, totalTime, gameState.zobristHash);
+	printSearchTimes(times);
+	std::cout << "info string ttstats " << getTTSearchStatsJson(stats) << std::endl;
+	#endif
+
+	// go infinite must not answer before stop, even once the depth limit is reached
+	while (limits.infinite && !stop.load(std::memory_order_relaxed)) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+	// Stopped before the first iteration finished, any legal move beats no move
+	if (bestMove.isNull() && rootMoves.back > 0) bestMove = rootMoves.list[0];
+
 	return bestMove;
 }
 
 // Used for GUI
-Move iterativeDeepeningSearch(GameState& gameState, std::vector<MoveInfo>& history, std::string& headerStats, std::string& TTStats, std::string& perPlyStats, std::string& searchTimes) {
+Move SearchWorker::iterativeDeepeningSearch(GameState& gameState, std::vector<MoveInfo>& history, std::string& headerStats, std::string& TTStats, std::string& perPlyStats, std::string& searchTimes) {
 	Move bestMove;
 	SearchContext context;
 	context.startTime = cntvct();
+	nodes.store(0, std::memory_order_relaxed);
+	context.deadline = deadlineAfter(context.startTime, TIME_PER_MOVE);
+	context.lastPoll = context.startTime;
 	context.searchCanceled = false;
 
-	g_EvalStack.reserve(MAX_PLY);
+	// makeMove still appends to the game history, reserving here keeps the search itself free of allocations
+	history.reserve(history.size() + MAX_PLY);
 	EvalState evalState{};
 	initEval(gameState, evalState, gameState.colorToMove);
+	previousPV.length = 0;
 
-	if (gameState.halfMoves == 0) g_GameRepetitionHistory.clear();
 
 	SearchStats stats;
 	SearchTimes times;
+	SearchInstrumentation instrumentation{stats, times};
 
-	for (int16 depth = 1; depth < 100; depth++) {
+	int16 score = 0;
+	for (int16 depth = 1; depth <= MAX_SEARCH_DEPTH; depth++) {
 		std::cout << depth << std::endl;
-		g_SearchRepetitionStack = g_GameRepetitionHistory;
 
-		alphaBetaSearch(gameState, evalState, history, context, NEG_INF, POS_INF, 0, depth, stats, times);
+		int16 iterationScore = aspirationSearch(gameState, evalState, history, context, score, depth, instrumentation);
 
 		if (context.searchCanceled) {
 			uint16 totalTime = getTimeElapsed(context.startTime);
+			stats.ttHashfull = tt.hashfull();
 			headerStats = getHeaderSearchStats(stats, depth, context.bestMoveThisIteration, totalTime, gameState.zobristHash);
 			TTStats = getTTSearchStats(stats);
 			perPlyStats = getPerPlySearchStats(stats);
@@ -210,289 +385,424 @@ Move iterativeDeepeningSearch(GameState& gameState, std::vector<MoveInfo>& histo
 		if (!context.bestMoveThisIteration.isNull()) {
 			bestMove = context.bestMoveThisIteration;
 		}
+		score = iterationScore;
+		previousPV = pvTable.rootLine();
 	}
 
 	return bestMove;
 }
 
-// Debug version
-int16 alphaBetaSearch(GameState& gameState, EvalState& evalState, std::vector<MoveInfo>& history, SearchContext& context, int16 alpha, int16 beta,
-					  uint8 pliesFromRoot, uint8 pliesRemaining, SearchStats& stats, SearchTimes& times) {
-	stats.nodes++;
-	if (stats.nodes == 1000000) {
-		EvalState testEvalState{}; 
-		initEval(gameState, testEvalState, gameState.colorToMove);
-		int16 testEval = getEval(testEvalState, gameState.colorToMove);
-		int16 eval = getEval(evalState, gameState.colorToMove);
-		if (eval != testEval) {
-			std::cout << "Test: " << testEval << " IncEval: " << eval << std::endl;
-			printBoard(gameState);
-		}
-		else std::cout << "Same" << std::endl;
-	}
-	stats.plyNodes[pliesFromRoot]++;
+// Lazy SMP helper: searches the same root on its own copy of the position and only talks to
+// the other threads through the TT. Odd helpers start one ply deeper so the threads spread
+// over two depths.
+void SearchWorker::helperSearch(GameState gameState, std::vector<MoveInfo> history, uint64 startTime, uint16 threadId) {
+	SearchContext context;
+	context.startTime = startTime;
+	context.lastPoll = startTime;
+	context.searchCanceled = false;
 
-	if (pliesRemaining <= 0) {
-		g_StartTime = cntvct();
-		auto eval = quiescenceSearch(gameState, evalState, history, context.bestMoveThisIteration, alpha, beta, 0, 5);
-		times.evaluation += cntvct() - g_StartTime;
-		return eval;
+	// makeMove still appends to the game history, reserving here keeps the search itself free of allocations
+	history.reserve(history.size() + MAX_PLY);
+	EvalState evalState{};
+	initEval(gameState, evalState, gameState.colorToMove);
+	previousPV.length = 0;
+
+	NoInstrumentation instrumentation;
+	int16 score = 0;
+	for (int16 depth = 1 + threadId % 2; depth <= MAX_SEARCH_DEPTH; depth++) {
+		score = aspirationSearch(gameState, evalState, history, context, score, depth, instrumentation);
+		if (context.searchCanceled) break;
+		previousPV = pvTable.rootLine();
 	}
+}
 
-	if (context.searchCanceled) return 0;
-
-	stats.ttProbes++;
-	g_StartTime = cntvct();
-	ttLookUpData ttData = g_TranspositionTable.lookUp(gameState.zobristHash, alpha, beta, pliesRemaining, stats);
-	times.transpositionLookUp += cntvct() - g_StartTime;
+bool SearchWorker::pollDeadline(SearchContext& context) {
+	uint64 now = cntvct();
+	uint64 period = cntfrq() * POLL_PERIOD_US / 1000000;
+	uint64 sinceLastPoll = now - context.lastPoll;
 
-	if (ttData.type == Score) return fromTTScore(ttData.value, pliesFromRoot);
-	if (ttData.type == AlphaIncrease) {
-		alpha = fromTTScore(ttData.value, pliesFromRoot);
-		if (alpha >= beta) return alpha;
-	}
-	else if (ttData.type == BetaIncrease) {
-		beta = fromTTScore(ttData.value, pliesFromRoot);
-		if (alpha >= beta) return alpha;
-	}
+	if (sinceLastPoll < period / 2) context.pollInterval = std::min(context.pollInterval * 2, MAX_POLL_INTERVAL);
+	else if (sinceLastPoll > period * 2) context.pollInterval = std::max(context.pollInterval / 2, MIN_POLL_INTERVAL);
+	context.lastPoll = now;
+	context.nodesUntilPoll = context.pollInterval;
 
-	g_StartTime = cntvct();
-	auto& moves = g_MovePool.getMoveList(pliesFromRoot);
-	bool isCheck;
-	generateAllMoves(gameState, moves, gameState.colorToMove, isCheck);
-	times.moveGeneration += cntvct() - g_StartTime;
-	uint16 movesSize = moves.back;
-	stats.legalMoves[pliesFromRoot] += movesSize;
+	return stop.load(std::memory_order_relaxed) || now >= context.deadline;
+}
 
-	g_StartTime = cntvct();
-	auto gameResult = getSearchGameResult(gameState, g_SearchRepetitionStack, movesSize, isCheck);
-	times.gameResultCheck += cntvct() - g_StartTime;
-	if (gameResult == Draw) return 0;
-	if (gameResult == Checkmate) return NEG_INF + pliesFromRoot;
+// Bumps the TT generation once for all threads and starts the helpers
+static void startSearch(GameState& gameState, const std::vector<MoveInfo>& history) {
+	g_TranspositionTable.prepare();
+	g_TranspositionTable.newSearch();
+	if (gameState.halfMoves == 0) g_MainWorker.gameRepetitionHistory.clear();
+
+	uint64 startTime = cntvct();
+	for (uint16 id = 1; id < g_ThreadCount; id++) {
+		SearchWorker* worker = g_HelperWorkers[id - 1].get();
+		worker->gameRepetitionHistory = g_MainWorker.gameRepetitionHistory;
+		// Reset before the thread starts, so the main thread never sums a count left from the last search
+		worker->nodes.store(0, std::memory_order_relaxed);
+		g_HelperThreads.emplace_back([worker, gameState, history, startTime, id]() {
+			worker->helperSearch(gameState, history, startTime, id);
+		});
+	}
+}
 
-	Move bestMoveInThisPos = moves.list[0];
-	Move ttMove = g_TranspositionTable.getTTMove(gameState.zobristHash);
-	MTEntry killers = g_MoveTable.table[pliesFromRoot];
+// Stops and joins the helpers once the main worker returned, then re-arms the flag for the next search
+static void stopSearch() {
+	g_StopSearch.store(true, std::memory_order_relaxed);
+	for (std::thread& t : g_HelperThreads) t.join();
+	g_HelperThreads.clear();
+	g_StopSearch.store(false, std::memory_order_relaxed);
+}
 
-	int16 originalAlpha = alpha;
+void requestSearchStop() { g_StopSearch.store(true, std::memory_order_relaxed); }
 
-	g_StartTime = cntvct();
-	PickMoveContext pickMoveContext = {g_ScoreMovePool.getScoreList(pliesFromRoot), context.bestMoveThisIteration, 
-					   ttMove, killers, 0, movesSize};
-	times.pickContextSetup += cntvct() - g_StartTime;
+void clearSearchStop() { g_StopSearch.store(false, std::memory_order_relaxed); }
 
-	int16 historyBonus = pliesRemaining >  8 ? 64 : pliesRemaining * pliesRemaining;
+Move iterativeDeepeningSearch(GameState& gameState, std::vector<MoveInfo>& history, const SearchLimits& limits) {
+	startSearch(gameState, history);
+	Move bestMove = g_MainWorker.iterativeDeepeningSearch(gameState, history, limits);
+	stopSearch();
+	return bestMove;
+}
 
-	g_StartTime = cntvct();
-	scoreMoves(gameState, moves, pickMoveContext, g_HistoryTable, g_CHistoryTable, g_FHistoryTable,
-	    	   g_CounterMoveTable, g_FollowUpMoveTable, g_ContStack);
-	times.moveScoring += cntvct() - g_StartTime;
+// Used for GUI
+Move iterativeDeepeningSearch(GameState& gameState, std::vector<MoveInfo>& history, std::string& headerStats, std::string& TTStats, std::string& perPlyStats, std::string& searchTimes) {
+	startSearch(gameState, history);
+	Move bestMove = g_MainWorker.iterativeDeepeningSearch(gameState, history, headerStats, TTStats, perPlyStats, searchTimes);
+	stopSearch();
+	return bestMove;
+}
 
-	bool fullSearched;
-	for (uint8 i = 0; i < movesSize; i++) {
-		if (getTimeElapsed(context.startTime) >= TIME_PER_MOVE) {
-			context.searchCanceled = true;
-			return 0;
+template <SearchNodeType nodeType, typename Instrumentation>
+int16 SearchWorker::alphaBetaSearch(GameState& gameState, EvalState& evalState, std::vector<MoveInfo>& history, SearchContext& context,
+				    int16 alpha, int16 beta, uint8 pliesFromRoot, uint8 pliesRemaining, Instrumentation& instrumentation) {
+	constexpr bool isRoot = nodeType == RootNode;
+	constexpr bool isPV = nodeType != NonPVNode;
+	// Children past the first are searched NonPV first and only re-searched as PV nodes
+	constexpr SearchNodeType childType = isPV ? PVNode : NonPVNode;
+
+	if constexpr (Instrumentation::ENABLED) {
+		SearchStats& stats = instrumentation.stats;
+		stats.nodes++;
+		if (stats.nodes == 1000000) {
+			EvalState testEvalState{}; 
+			initEval(gameState, testEvalState, gameState.colorToMove);
+			int16 testEval = getEval(testEvalState, gameState.colorToMove);
+			int16 eval = getEval(evalState, gameState.colorToMove);
+			if (eval != testEval) {
+				std::cout << "Test: " << testEval << " IncEval: " << eval << std::endl;
+				printBoard(gameState);
+			}
+			else std::cout << "Same" << std::endl;
 		}
+		stats.plyNodes[pliesFromRoot]++;
+	}
+	countNode();
+	context.selDepth = std::max(context.selDepth, pliesFromRoot);
+	pvTable.clear(pliesFromRoot);
 
-		g_StartTime = cntvct();
-		Move move = pickMove(moves, pickMoveContext);
-		times.movePicking += cntvct() - g_StartTime;
-
-		MoveBucket mBucket = getBucketType(pickMoveContext.scores.list[i]);
+	if (pliesRemaining <= 0) {
+		instrumentation.startTimer();
+		int16 eval = quiescenceSearch(gameState, evalState, history, context, pvMoveAt(pliesFromRoot), alpha, beta, pliesFromRoot, QUIESCENCE_DEPTH);
+		instrumentation.stopTimer(&SearchTimes::evaluation);
+		return eval;
+	}
 
-		g_StartTime = cntvct();
-		g_ContStack.push(gameState, move);
-		updateEval(gameState, move, gameState.colorToMove, evalState, g_EvalStack);
-		gameState.makeMove(move, history);
-		times.moveMaking += cntvct() - g_StartTime;
+	if (context.searchCanceled) return 0;
 
-		g_StartTime = cntvct();
-		g_SearchRepetitionStack.push(gameState.zobristHash);
-		times.repetitionPush += cntvct() - g_StartTime;
+	// No cutoffs in PV nodes: the root has to produce a move and the others a full line for the PV table
+	if constexpr (!isPV) {
+		instrumentation.startTimer();
+		ttLookUpData ttData;
+		if constexpr (Instrumentation::ENABLED) {
+			instrumentation.stats.ttProbes++;
+			ttData = tt.lookUp(gameState.zobristHash, alpha, beta, pliesRemaining, instrumentation.stats);
+		}
+		else ttData = tt.lookUp(gameState.zobristHash, alpha, beta, pliesRemaining);
+		instrumentation.stopTimer(&SearchTimes::transpositionLookUp);
 
-		int16 eval;
-		uint8 r = getLMR(move, pliesRemaining, i, isCheck, beta != alpha + 1, ttMove, killers, pickMoveContext.scores.list[i]);
-		fullSearched = i == 0;
-		bool reSearched = false;
-		if (i == 0) {
-			eval = -alphaBetaSearch(gameState, evalState, history, context, -beta, -alpha, pliesFromRoot + 1, pliesRemaining - 1, stats, times);
+		if (ttData.type == Score) return fromTTScore(ttData.value, pliesFromRoot);
+		if (ttData.type == AlphaIncrease) {
+			alpha = fromTTScore(ttData.value, pliesFromRoot);
+			if (alpha >= beta) return alpha;
 		}
-		else {
-			eval = -alphaBetaSearch(gameState, evalState, history, context, -alpha - 1, -alpha, pliesFromRoot + 1, pliesRemaining - 1 - r, stats, times);
-			if (eval > alpha) {
-				reSearched = true;
-				eval = -alphaBetaSearch(gameState, evalState, history, context, -beta, -alpha, pliesFromRoot + 1, pliesRemaining - 1, stats, times);
-			}
+		else if (ttData.type == BetaIncrease) {
+			beta = fromTTScore(ttData.value, pliesFromRoot);
+			if (alpha >= beta) return alpha;
 		}
-		fullSearched = fullSearched || reSearched;
-
-		g_StartTime = cntvct();
-		g_SearchRepetitionStack.pop(gameState.zobristHash);
-		times.repetitionPop += cntvct() - g_StartTime;
-
-		g_StartTime = cntvct();
-		gameState.unmakeMove(move, history);
-		g_ContStack.pop();
-		undoEvalUpdate(evalState, g_EvalStack);
-		times.moveUnmaking += cntvct() - g_StartTime;
-
-		stats.bucketTried[mBucket]++;
-		
-		if (eval > alpha) {
-			bestMoveInThisPos = move;
-			alpha = eval;
+	}
 
-			if (pliesFromRoot == 0) context.bestMoveThisIteration = move;
-		}
-		if (alpha >= beta) {
-			if (!move.isCapture() && fullSearched) {
-				g_CounterMoveTable.addMove(move, g_ContStack);
-				g_FollowUpMoveTable.addMove(move, g_ContStack);
-				g_MoveTable.storeEntry(pliesFromRoot, move);
-				g_HistoryTable.update(gameState.colorToMove, move.getStartSquare(), move.getTargetSquare(), historyBonus);
-				g_CHistoryTable.update(gameState.pieceAt(move.getStartSquare()), move.getTargetSquare(), historyBonus, g_ContStack);
-				g_FHistoryTable.update(gameState.pieceAt(move.getStartSquare()), move.getTargetSquare(), historyBonus, g_ContStack);
+	Color them = gameState.colorToMove == White ? Black : White;
+	bool isCheck = isSquareAttacked(gameState, gameState.bitboards[gameState.colorToMove == White ? WKing : BKing], them);
+
+	instrumentation.startTimer();
+	bool isDraw = isSearchDraw(gameState, searchRepetitionStack, isCheck);
+	instrumentation.stopTimer(&SearchTimes::gameResultCheck);
+	if (isDraw) return 0;
+
+	// Compared with the eval two plies up, our last move, to tell whether our position is getting better.
+	// After a check there is nothing to compare with, leaving check counts as improving.
+	int16 staticEval = isCheck ? NO_EVAL : getEval(evalState, gameState.colorToMove);
+	searchStack[pliesFromRoot].staticEval = staticEval;
+	bool improving = !isCheck && (pliesFromRoot < 2 || searchStack[pliesFromRoot - 2].staticEval == NO_EVAL ||
+				      staticEval > searchStack[pliesFromRoot - 2].staticEval);
+
+	if constexpr (!isPV) {
+		if (!isCheck && !isMateScore(beta)) {
+			if (pliesRemaining <= REVERSE_FUTILITY_MAX_DEPTH && staticEval - REVERSE_FUTILITY_MARGIN * (pliesRemaining - improving) >= beta) {
+				if constexpr (Instrumentation::ENABLED) instrumentation.stats.reverseFutilityPrunes++;
+				return staticEval;
 			}
-			stats.prunedNodes += movesSize - (i+1);
-			stats.betaCutOffs++;
-			stats.cutoffCount[pliesFromRoot]++;
-			stats.bucketCutoffs[mBucket]++;
-			stats.cutoffIndexSum[pliesFromRoot] += i;
-			stats.bucketIndexSum[mBucket] += i;
-			if (i == 0) {
-				stats.firstMoveCutoffs[pliesFromRoot]++;
-				stats.bucketFirstCutoffs[mBucket]++;
+
+			if (pliesRemaining <= RAZOR_MAX_DEPTH && staticEval + RAZOR_MARGIN * pliesRemaining < alpha) {
+				instrumentation.startTimer();
+				int16 eval = quiescenceSearch(gameState, evalState, history, context, NULL_MOVE, alpha, alpha + 1, pliesFromRoot, QUIESCENCE_DEPTH);
+				instrumentation.stopTimer(&SearchTimes::evaluation);
+				if (context.searchCanceled) return 0;
+				if (eval <= alpha) {
+					if constexpr (Instrumentation::ENABLED) instrumentation.stats.razorPrunes++;
+					return eval;
+				}
 			}
-			break;
-		}
-		if (!move.isCapture() && fullSearched) {
-			int16 historyMalus = -historyBonus / 16;
-			g_HistoryTable.update(gameState.colorToMove, move.getStartSquare(), move.getTargetSquare(), historyMalus);
-			g_CHistoryTable.update(gameState.pieceAt(move.getStartSquare()), move.getTargetSquare(), historyMalus, g_ContStack);
-			g_FHistoryTable.update(gameState.pieceAt(move.getStartSquare()), move.getTargetSquare(), historyMalus, g_ContStack);
 		}
 	}
 
-	stats.ttStores++;
-	g_StartTime = cntvct();
-	g_TranspositionTable.storeEntry(gameState.zobristHash, bestMoveInThisPos, pliesFromRoot, pliesRemaining, alpha, beta, originalAlpha);
-	switch (g_TranspositionTable.getNodeType(alpha, beta, originalAlpha)) {
-		case Exact: stats.ttStoresExact++; break;
-		case LowerBound: stats.ttStoresLower++; break;
-		case UpperBound: stats.ttStoresUpper++; break;
+	// Null move pruning: if passing still fails high the position is good enough to cut off.
+	// Not in check, not twice in a row and not without pieces, where zugzwang makes passing unsound.
+	if constexpr (!isPV) {
+		if (!isCheck && pliesRemaining >= NULL_MOVE_MIN_DEPTH && !searchStack[pliesFromRoot - 1].nullMove &&
+		    !isMateScore(beta) && hasNonPawnMaterial(gameState, gameState.colorToMove) && staticEval >= beta) {
+			uint8 r = NULL_MOVE_REDUCTION + (pliesRemaining > NULL_MOVE_ADAPTIVE_DEPTH);
+			uint8 childPlies = pliesRemaining > r + 1 ? pliesRemaining - r - 1 : 0;
+
+			searchStack[pliesFromRoot + 1].followingPV = false;
+			searchStack.pushNull();
+			uint8 previousEnPassantFile = gameState.makeNullMove();
+			int16 eval = -alphaBetaSearch<NonPVNode>(gameState, evalState, history, context, -beta, -beta + 1, pliesFromRoot + 1, childPlies, instrumentation);
+			gameState.unmakeNullMove(previousEnPassantFile);
+			searchStack.pop();
+
+			if (context.searchCanceled) return 0;
+			if constexpr (Instrumentation::ENABLED) instrumentation.stats.nullMoveSearches++;
+			if (eval >= beta) {
+				if constexpr (Instrumentation::ENABLED) instrumentation.stats.nullMoveCutoffs++;
+				// An unproven mate found after passing is not trusted
+				return isMateScore(eval) ? beta : eval;
+			}
+		}
 	}
-	times.transpositionInsertion += cntvct() - g_StartTime;
-	return alpha;
-}
-
-// Release version
-int16 alphaBetaSearch(GameState& gameState, EvalState& evalState, std::vector<MoveInfo>& history, SearchContext& context, 
-					  int16 alpha, int16 beta, uint8 pliesFromRoot, uint8 pliesRemaining) {
 
-	if (pliesRemaining <= 0) return quiescenceSearch(gameState, evalState, history, context.bestMoveThisIteration, alpha, beta, 0, 5);
-
-	if (context.searchCanceled) return 0;
+	Move bestMoveInThisPos = NULL_MOVE;
+	Move ttMove = tt.getTTMove(gameState.zobristHash);
+	MTEntry killers = searchStack[pliesFromRoot].killers;
 
-	ttLookUpData ttData = g_TranspositionTable.lookUp(gameState.zobristHash, alpha, beta, pliesRemaining);
-	if (ttData.type == Score) return fromTTScore(ttData.value, pliesFromRoot);
-	if (ttData.type == AlphaIncrease) {
-		alpha = fromTTScore(ttData.value, pliesFromRoot);
-		if (alpha >= beta) return alpha;
+	// A key match whose move is not legal here means the entry belongs to another position
+	if constexpr (Instrumentation::ENABLED) {
+		if (!ttMove.isNull() && !(isPseudoLegal(gameState, ttMove) && isLegal(gameState, ttMove)))
+			instrumentation.stats.ttKeyCollisions++;
 	}
-	else if (ttData.type == BetaIncrease) {
-		beta = fromTTScore(ttData.value, pliesFromRoot);
-		if (alpha >= beta) return alpha;
-	}
-
-	auto& moves = g_MovePool.getMoveList(pliesFromRoot);
-	bool isCheck;
-	generateAllMoves(gameState, moves, gameState.colorToMove, isCheck);
-	uint16 movesSize = moves.back;
-
-	auto gameResult = getSearchGameResult(gameState, g_SearchRepetitionStack, movesSize, isCheck);
-
-	if (gameResult == Draw) return 0;
-	if (gameResult == Checkmate) return NEG_INF + pliesFromRoot;
 
-	Move bestMoveInThisPos = moves.list[0];
-	Move ttMove = g_TranspositionTable.getTTMove(gameState.zobristHash);
-	MTEntry killers = g_MoveTable.table[pliesFromRoot];
 	int16 originalAlpha = alpha;
-	bool fullSearched;
 
-	PickMoveContext pickMoveContext = {g_ScoreMovePool.getScoreList(pliesFromRoot), context.bestMoveThisIteration, 
-					   ttMove, killers, 0, movesSize};
+	instrumentation.startTimer();
+	Move pvMove = pvMoveAt(pliesFromRoot);
+	MovePicker picker(gameState, searchStack[pliesFromRoot].moves, searchStack[pliesFromRoot].scores, pvMove,
+			  ttMove, killers, isCheck, historyTable, cHistoryTable, fHistoryTable, counterMoveTable, followUpMoveTable, searchStack);
+	instrumentation.stopTimer(&SearchTimes::pickContextSetup);
 
 	int16 historyBonus = pliesRemaining >  8 ? 64 : pliesRemaining * pliesRemaining;
 
-	scoreMoves(gameState, moves, pickMoveContext, g_HistoryTable, g_CHistoryTable, g_FHistoryTable, 
-	    	   g_CounterMoveTable, g_FollowUpMoveTable, g_ContStack);
+	// Frontier nodes too far below alpha for a quiet move to matter, only tactical moves and checks are searched
+	bool futile = !isPV && !isCheck && pliesRemaining <= FUTILITY_MAX_DEPTH && !isMateScore(alpha) &&
+		      staticEval + FUTILITY_MARGIN * pliesRemaining <= alpha;
 
-	for (uint8 i = 0; i < movesSize; i++) {
-		if (getTimeElapsed(context.startTime) >= TIME_PER_MOVE) {
+	// Later MultiPV lines never see the root moves of the lines before them
+	auto nextMove = [&]() {
+		Move move = picker.next(instrumentation);
+		if constexpr (isRoot) while (!move.isNull() && isExcludedRootMove(move, context)) move = picker.next(instrumentation);
+		return move;
+	};
+
+	bool fullSearched;
+	uint8 i = 0;
+	for (Move move; !(move = nextMove()).isNull(); i++) {
+		if (shouldStop(context)) {
 			context.searchCanceled = true;
 			return 0;
 		}
+		if (bestMoveInThisPos.isNull()) bestMoveInThisPos = move;
+
+		MoveBucket mBucket = getBucketType(move, picker.score);
+
+		// Quiets past the first move that are late, badly scored by history or futile
+		if (!isPV && !isCheck && i > 0 && !isMateScore(alpha) && !move.isCapture() && !move.isPromotion()) {
+			uint64 SearchStats::* prune = nullptr;
+			if (pliesRemaining <= LATE_MOVE_PRUNING_MAX_DEPTH && i >= LATE_MOVE_PRUNING_COUNT[improving][pliesRemaining])
+				prune = &SearchStats::lateMovePrunes;
+			else if (pliesRemaining <= HISTORY_PRUNING_MAX_DEPTH && (int32)picker.score - QUIET_BASE < -HISTORY_PRUNING_MARGIN * pliesRemaining)
+				prune = &SearchStats::historyPrunes;
+			else if (futile) {
+				Color us = gameState.colorToMove;
+				Piece captured = gameState.tempMakeMove(move);
+				bool givesCheck = isSquareAttacked(gameState, gameState.bitboards[them == White ? WKing : BKing], us);
+				gameState.tempUnmakeMove(move, captured);
+				if (!givesCheck) prune = &SearchStats::futilityPrunes;
+			}
 
-		Move move = pickMove(moves, pickMoveContext);
+			if (prune) {
+				if constexpr (Instrumentation::ENABLED) {
+					instrumentation.stats.*prune += 1;
+					instrumentation.stats.bucketPruned[mBucket]++;
+				}
+				continue;
+			}
+		}
+
+		tt.prefetch(gameState.keyAfter(move));
+		searchStack[pliesFromRoot + 1].followingPV = searchStack[pliesFromRoot].followingPV && move.val == pvMove.val;
 
-		g_ContStack.push(gameState, move);
-		updateEval(gameState, move, gameState.colorToMove, evalState, g_EvalStack);
+		instrumentation.startTimer();
+		searchStack.push(gameState, move);
+		updateEval(gameState, move, gameState.colorToMove, evalState, searchStack[pliesFromRoot].evalDelta);
 		gameState.makeMove(move, history);
-		g_SearchRepetitionStack.push(gameState.zobristHash);
+		instrumentation.stopTimer(&SearchTimes::moveMaking);
+
+		instrumentation.startTimer();
+		searchRepetitionStack.push(gameState.zobristHash);
+		instrumentation.stopTimer(&SearchTimes::repetitionPush);
 
 		int16 eval;
-		uint8 r = getLMR(move, pliesRemaining, i, isCheck, beta != alpha + 1, ttMove, killers, pickMoveContext.scores.list[i]);
-		fullSearched = (i == 0);
+		uint8 r = getLMR(move, pliesRemaining, i, isCheck, isPV, ttMove, killers, picker.score);
+		fullSearched = i == 0;
 		bool reSearched = false;
 		if (i == 0) {
-			eval = -alphaBetaSearch(gameState, evalState, history, context, -beta, -alpha, pliesFromRoot + 1, pliesRemaining - 1);
+			eval = -alphaBetaSearch<childType>(gameState, evalState, history, context, -beta, -alpha, pliesFromRoot + 1, pliesRemaining - 1, instrumentation);
 		}
 		else {
-			eval = -alphaBetaSearch(gameState, evalState, history, context, -alpha - 1, -alpha, pliesFromRoot + 1, pliesRemaining - 1 - r);
-			if (eval > alpha) {
+			eval = -alphaBetaSearch<NonPVNode>(gameState, evalState, history, context, -alpha - 1, -alpha, pliesFromRoot + 1, pliesRemaining - 1 - r, instrumentation);
+			if (eval > alpha && !context.searchCanceled) {
 				reSearched = true;
-				eval = -alphaBetaSearch(gameState, evalState, history, context, -beta, -alpha, pliesFromRoot + 1, pliesRemaining - 1);
+				eval = -alphaBetaSearch<childType>(gameState, evalState, history, context, -beta, -alpha, pliesFromRoot + 1, pliesRemaining - 1, instrumentation);
 			}
 		}
 		fullSearched = fullSearched || reSearched;
 
-		g_SearchRepetitionStack.pop(gameState.zobristHash);
+		instrumentation.startTimer();
+		searchRepetitionStack.pop(gameState.zobristHash);
+		instrumentation.stopTimer(&SearchTimes::repetitionPop);
+
+		instrumentation.startTimer();
 		gameState.unmakeMove(move, history);
-		undoEvalUpdate(evalState, g_EvalStack);
-		g_ContStack.pop();
+		searchStack.pop();
+		undoEvalUpdate(evalState, searchStack[pliesFromRoot].evalDelta);
+		instrumentation.stopTimer(&SearchTimes::moveUnmaking);
+
+		// A canceled child returns 0, which must not reach alpha, the move tables or the TT
+		if (context.searchCanceled) return 0;
+
+		if constexpr (Instrumentation::ENABLED) instrumentation.stats.bucketTried[mBucket]++;
 
 		if (eval > alpha) {
 			bestMoveInThisPos = move;
 			alpha = eval;
+			if constexpr (isPV) pvTable.update(pliesFromRoot, move);
 
-			if (pliesFromRoot == 0) context.bestMoveThisIteration = move;
+			if constexpr (isRoot) if (context.pvIndex == 0) context.bestMoveThisIteration = move;
 		}
 		if (alpha >= beta) {
 			if (!move.isCapture() && fullSearched) {
-				g_CounterMoveTable.addMove(move, g_ContStack);
-				g_FollowUpMoveTable.addMove(move, g_ContStack);
-				g_MoveTable.storeEntry(pliesFromRoot, move);
-				g_HistoryTable.update(gameState.colorToMove, move.getStartSquare(), move.getTargetSquare(), historyBonus);
-				g_CHistoryTable.update(gameState.pieceAt(move.getStartSquare()), move.getTargetSquare(), historyBonus, g_ContStack);
-				g_FHistoryTable.update(gameState.pieceAt(move.getStartSquare()), move.getTargetSquare(), historyBonus, g_ContStack);
+				counterMoveTable.addMove(move, searchStack);
+				followUpMoveTable.addMove(move, searchStack);
+				searchStack.storeKiller(pliesFromRoot, move);
+				historyTable.update(gameState.colorToMove, move.getStartSquare(), move.getTargetSquare(), historyBonus);
+				cHistoryTable.update(gameState.pieceAt(move.getStartSquare()), move.getTargetSquare(), historyBonus, searchStack);
+				fHistoryTable.update(gameState.pieceAt(move.getStartSquare()), move.getTargetSquare(), historyBonus, searchStack);
+			}
+			if constexpr (Instrumentation::ENABLED) {
+				SearchStats& stats = instrumentation.stats;
+				stats.prunedNodes += picker.generated - (i+1);
+				stats.betaCutOffs++;
+				stats.cutoffCount[pliesFromRoot]++;
+				stats.bucketCutoffs[mBucket]++;
+				stats.cutoffIndexSum[pliesFromRoot] += i;
+				stats.bucketIndexSum[mBucket] += i;
+				if (i == 0) {
+					stats.firstMoveCutoffs[pliesFromRoot]++;
+					stats.bucketFirstCutoffs[mBucket]++;
+				}
 			}
 			break;
 		}
 		if (!move.isCapture() && fullSearched) {
 			int16 historyMalus = -historyBonus / 16;
-			g_HistoryTable.update(gameState.colorToMove, move.getStartSquare(), move.getTargetSquare(), historyMalus);
-			g_CHistoryTable.update(gameState.pieceAt(move.getStartSquare()), move.getTargetSquare(), historyMalus, g_ContStack);
-			g_FHistoryTable.update(gameState.pieceAt(move.getStartSquare()), move.getTargetSquare(), historyMalus, g_ContStack);
+			historyTable.update(gameState.colorToMove, move.getStartSquare(), move.getTargetSquare(), historyMalus);
+			cHistoryTable.update(gameState.pieceAt(move.getStartSquare()), move.getTargetSquare(), historyMalus, searchStack);
+			fHistoryTable.update(gameState.pieceAt(move.getStartSquare()), move.getTargetSquare(), historyMalus, searchStack);
 		}
 	}
 
-	g_TranspositionTable.storeEntry(gameState.zobristHash, bestMoveInThisPos, pliesFromRoot, pliesRemaining, alpha, beta, originalAlpha);
+	// Moves are generated lazily, so only count what the picker actually produced
+	if constexpr (Instrumentation::ENABLED) instrumentation.stats.legalMoves[pliesFromRoot] += picker.generated;
+	if (bestMoveInThisPos.isNull()) return isCheck ? NEG_INF + pliesFromRoot : 0;
+
+	// A root searched without its best moves says nothing about the position itself
+	if constexpr (isRoot) if (context.pvIndex > 0) return alpha;
+
+	instrumentation.startTimer();
+	[[maybe_unused]] StoreType storeType = tt.storeEntry(gameState.zobristHash, bestMoveInThisPos, pliesFromRoot, pliesRemaining, alpha, beta, originalAlpha,
+					    getEval(evalState, gameState.colorToMove));
+	if constexpr (Instrumentation::ENABLED) {
+		SearchStats& stats = instrumentation.stats;
+		stats.ttStores++;
+		switch (tt.getNodeType(alpha, beta, originalAlpha)) {
+			case Exact: stats.ttStoresExact++; break;
+			case LowerBound: stats.ttStoresLower++; break;
+			case UpperBound: stats.ttStoresUpper++; break;
+		}
+		switch (storeType) {
+			case StoreEmpty: stats.ttStoresEmpty++; break;
+			case StoreOverwrite: stats.ttOverwrites++; break;
+			case StoreSameKey: stats.ttSameKeyUpdates++; break;
+			case StoreRejected: stats.ttRejectedStores++; break;
+		}
+	}
+	instrumentation.stopTimer(&SearchTimes::transpositionInsertion);
 	return alpha;
 }
 
-MoveBucket getBucketType(uint16 score) {
+void runThreadScalingBenchmark(int16 depth) {
+	const std::vector<std::string> positions = {
+		std::string(DEFAULT_FEN_POSITION),
+		"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+		"r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+		"8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+	};
+
+	uint16 previousThreads = g_ThreadCount;
+	uint64 baseline = 0;
+	for (uint16 threads = 1; threads <= 32; threads *= 2) {
+		setSearchThreads(threads);
+		uint64 total = 0;
+		for (const std::string& fen : positions) {
+			clearTranspositionTable();
+			clearHistoryTables();
+			GameState state(fen);
+			std::vector<MoveInfo> history;
+			uint64 start = cntvct();
+			SearchLimits limits;
+			limits.depth = depth;
+			iterativeDeepeningSearch(state, history, limits);
+			total += getTimeElapsed(start);
+		}
+		if (threads == 1) baseline = std::max<uint64>(total, 1);
+		std::cout << "threads " << threads << " depth " << depth << " time " << total << "ms speedup "
+			  << std::fixed << std::setprecision(2) << static_cast<double>(baseline) / std::max<uint64>(total, 1) << std::endl;
+	}
+	setSearchThreads(previousThreads);
+}
+
+MoveBucket getBucketType(Move move, uint16 score) {
 	if (score == PV_MOVE_SCORE) return B_PV;
 	else if (score == TT_MOVE_SCORE) return B_TT;
 	else if (score >= PROMOTION_BASE) return B_Promo;
@@ -501,7 +811,7 @@ MoveBucket getBucketType(uint16 score) {
 	else if (score >= COUNTER_MOVE_SCORE) return B_Counter;
 	else if (score >= FOLLOW_UP_MOVE_SCORE) return B_FollowUp;
 	else if (score >= KILLER_MOVE_2_SCORE) return B_Killer2;
-	else if (score >= QUIET_BASE) return B_QuietHist;
+	else if (!move.isCapture() && !move.isPromotion()) return B_QuietHist;
 	else if (score >= BAD_CAPTURE_BASE) return B_BadCap;
 	return B_Other;
 }
@@ -567,6 +877,26 @@ std::string getHeaderSearchStats(const SearchStats& s, int16 depth, const Move&
 	   << setw(VALUE_W) << right << s.prunedNodes << "\n"
 	   << setw(LABEL_W) << left << (std::string(CLR_LABEL) + "  Beta cutoffs:" + CLR_RESET)
 	   << setw(VALUE_W) << right << s.betaCutOffs << "\n"
+	   << setw(LABEL_W) << left << (std::string(CLR_LABEL) + "  Asp. fail lows:" + CLR_RESET)
+	   << setw(VALUE_W) << right << s.aspirationFailLows << "\n"
+	   << setw(LABEL_W) << left << (std::string(CLR_LABEL) + "  Asp. fail highs:" + CLR_RESET)
+	   << setw(VALUE_W) << right << s.aspirationFailHighs << "\n"
+	   << setw(LABEL_W) << left << (std::string(CLR_LABEL) + "  Asp. re-searches:" + CLR_RESET)
+	   << setw(VALUE_W) << right << s.aspirationResearches << "\n"
+	   << setw(LABEL_W) << left << (std::string(CLR_LABEL) + "  Null move searches:" + CLR_RESET)
+	   << setw(VALUE_W) << right << s.nullMoveSearches << "\n"
+	   << setw(LABEL_W) << left << (std::string(CLR_LABEL) + "  Null move cutoffs:" + CLR_RESET)
+	   << setw(VALUE_W) << right << s.nullMoveCutoffs << "\n"
+	   << setw(LABEL_W) << left << (std::string(CLR_LABEL) + "  Reverse futility prunes:" + CLR_RESET)
+	   << setw(VALUE_W) << right << s.reverseFutilityPrunes << "\n"
+	   << setw(LABEL_W) << left << (std::string(CLR_LABEL) + "  Futility prunes:" + CLR_RESET)
+	   << setw(VALUE_W) << right << s.futilityPrunes << "\n"
+	   << setw(LABEL_W) << left << (std::string(CLR_LABEL) + "  Razor prunes:" + CLR_RESET)
+	   << setw(VALUE_W) << right << s.razorPrunes << "\n"
+	   << setw(LABEL_W) << left << (std::string(CLR_LABEL) + "  Late move prunes:" + CLR_RESET)
+	   << setw(VALUE_W) << right << s.lateMovePrunes << "\n"
+	   << setw(LABEL_W) << left << (std::string(CLR_LABEL) + "  History prunes:" + CLR_RESET)
+	   << setw(VALUE_W) << right << s.historyPrunes << "\n"
 	   << setw(LABEL_W) << left << (std::string(CLR_LABEL) + "  NPS (nodes/sec):" + CLR_RESET)
 	   << setw(VALUE_W) << right << std::fixed << setprecision(0) << nps << "\n";
 	ss << SEP;
@@ -624,13 +954,49 @@ std::string getTTSearchStats(const SearchStats& s) {
 	   << setw(LABEL_W) << left << (std::string(CLR_LABEL) + "	  Lower-bound stores:" + CLR_RESET)
 	   << setw(VALUE_W) << right << s.ttStoresLower << "\n"
 	   << setw(LABEL_W) << left << (std::string(CLR_LABEL) + "	  Upper-bound stores:" + CLR_RESET)
-	   << setw(VALUE_W) << right << s.ttStoresUpper << "\n";
+	   << setw(VALUE_W) << right << s.ttStoresUpper << "\n"
+	   << setw(LABEL_W) << left << (std::string(CLR_LABEL) + "	  Into empty slots:" + CLR_RESET)
+	   << setw(VALUE_W) << right << s.ttStoresEmpty << "\n"
+	   << setw(LABEL_W) << left << (std::string(CLR_LABEL) + "	  Overwrites:" + CLR_RESET)
+	   << setw(VALUE_W) << right << s.ttOverwrites << "\n"
+	   << setw(LABEL_W) << left << (std::string(CLR_LABEL) + "	  Same-key updates:" + CLR_RESET)
+	   << setw(VALUE_W) << right << s.ttSameKeyUpdates << "\n"
+	   << setw(LABEL_W) << left << (std::string(CLR_LABEL) + "	  Rejected stores:" + CLR_RESET)
+	   << setw(VALUE_W) << right << s.ttRejectedStores << "\n"
+	   << SEP
+	   << setw(LABEL_W) << left << (std::string(CLR_LABEL) + "  TT key collisions:" + CLR_RESET)
+	   << setw(VALUE_W) << right << s.ttKeyCollisions
+	   << "  (" << std::fixed << setprecision(3) << pct(s.ttKeyCollisions, s.ttHits) << "% of hits)\n"
+	   << setw(LABEL_W) << left << (std::string(CLR_LABEL) + "  TT hashfull:" + CLR_RESET)
+	   << setw(VALUE_W) << right << s.ttHashfull
+	   << "  (" << std::fixed << setprecision(1) << s.ttHashfull / 10.0 << "%)\n";
 
 	ss << SEP;
 
 	return ss.str();
 }
 
+std::string getTTSearchStatsJson(const SearchStats& s) {
+	std::ostringstream ss;
+	ss << "{"
+	   << "\"probes\":" << s.ttProbes
+	   << ",\"hits\":" << s.ttHits
+	   << ",\"usefulHits\":" << s.ttHitsUseful
+	   << ",\"cutoffHits\":" << s.ttHitCutoffs
+	   << ",\"stores\":" << s.ttStores
+	   << ",\"storesExact\":" << s.ttStoresExact
+	   << ",\"storesLower\":" << s.ttStoresLower
+	   << ",\"storesUpper\":" << s.ttStoresUpper
+	   << ",\"storesEmpty\":" << s.ttStoresEmpty
+	   << ",\"overwrites\":" << s.ttOverwrites
+	   << ",\"sameKeyUpdates\":" << s.ttSameKeyUpdates
+	   << ",\"rejectedStores\":" << s.ttRejectedStores
+	   << ",\"keyCollisions\":" << s.ttKeyCollisions
+	   << ",\"hashfull\":" << s.ttHashfull
+	   << "}";
+	return ss.str();
+}
+
 std::string getPerPlySearchStats(const SearchStats& s) {
 	using std::left;
 	using std::right;
@@ -722,6 +1088,7 @@ std::string getPerPlySearchStats(const SearchStats& s) {
 	ss << "	" << setw(18) << left << "Bucket"
 	   << setw(18) << right << "Tried"
 	   << setw(18) << right << "Cutoffs"
+	   << setw(18) << right << "Pruned"
 	   << setw(24) << right << "Avg cutoff idx"
 	   << setw(24) << right << "First-move (%)"
 	   << "\n";
@@ -735,6 +1102,7 @@ std::string getPerPlySearchStats(const SearchStats& s) {
 		ss << "	" << setw(18) << left  << BUCKET_NAMES[i]
 		   << setw(18) << right << tried
 		   << setw(18) << right << cuts
+		   << setw(18) << right << s.bucketPruned[i]
 		   << std::fixed << setprecision(2);
 		{
 			std::ostringstream tmp;
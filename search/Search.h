@@ -1,16 +1,73 @@
 #pragma once
 
+#include <atomic>
+
+#include "../chess/GameRules.h"
 #include "../chess/GameState.h"
+#include "../helpers/Timer.h"
 #include "../search/MoveSorter.h"
 #include "Common.h"
 #include "Evaluation.h"
+#include "SearchStack.h"
+#include "TimeManager.h"
 
 constexpr uint64 TIME_PER_MOVE = 5000;
-constexpr uint64 MAX_PLY = 30;
+constexpr uint16 MAX_SEARCH_THREADS = 256;
+// Root lines searched and reported per iteration in MultiPV mode
+constexpr uint8 MAX_MULTI_PV = 64;
+// Plies of captures searched past the horizon
+constexpr uint8 QUIESCENCE_DEPTH = 5;
+// Plies from root never exceed the iteration depth plus the qsearch plies, so this keeps the per ply tables in range
+constexpr int16 MAX_SEARCH_DEPTH = MAX_PLY - 1 - QUIESCENCE_DEPTH;
+
+// The poll interval adapts to NPS so the clock is read roughly every POLL_PERIOD_US
+constexpr uint32 MIN_POLL_INTERVAL = 64;
+constexpr uint32 MAX_POLL_INTERVAL = 16384;
+constexpr uint64 POLL_PERIOD_US = 100;
+
+// From ASPIRATION_MIN_DEPTH on the root is searched ASPIRATION_WINDOW either side of the previous score.
+// Every fail low or high multiplies the window by ASPIRATION_WIDENING before the re-search.
+constexpr int16 ASPIRATION_MIN_DEPTH = 4;
+constexpr int32 ASPIRATION_WINDOW = 50;
+constexpr int32 ASPIRATION_WIDENING = 2;
+
+// Null move pruning from NULL_MOVE_MIN_DEPTH plies remaining, reducing by NULL_MOVE_REDUCTION plies
+// and one more once more than NULL_MOVE_ADAPTIVE_DEPTH plies remain
+constexpr uint8 NULL_MOVE_MIN_DEPTH = 3;
+constexpr uint8 NULL_MOVE_REDUCTION = 2;
+constexpr uint8 NULL_MOVE_ADAPTIVE_DEPTH = 6;
+
+// Shallow pruning on the static eval, margins in centipawns per remaining ply.
+// Reverse futility returns the static eval when it beats beta by the margin, futility skips quiets that
+// cannot raise it to alpha, razoring drops into qsearch when it is far below alpha.
+constexpr uint8 REVERSE_FUTILITY_MAX_DEPTH = 6;
+constexpr int16 REVERSE_FUTILITY_MARGIN = 80;
+constexpr uint8 FUTILITY_MAX_DEPTH = 3;
+constexpr int16 FUTILITY_MARGIN = 110;
+constexpr uint8 RAZOR_MAX_DEPTH = 2;
+constexpr int16 RAZOR_MARGIN = 300;
+
+// Quiets are skipped outright at low depth once LATE_MOVE_PRUNING_COUNT moves were tried, or when their
+// history and continuation history sum is below -HISTORY_PRUNING_MARGIN per remaining ply
+constexpr uint8 LATE_MOVE_PRUNING_MAX_DEPTH = 3;
+constexpr uint8 HISTORY_PRUNING_MAX_DEPTH = 3;
+constexpr int32 HISTORY_PRUNING_MARGIN = 1000;
+
+// Marks plies whose static eval is unknown because the side to move was in check, see SearchStackEntry
+constexpr int16 NO_EVAL = NEG_INF;
 
 typedef struct SearchContext {
 	uint64 startTime;
+	// Hard limit in raw counter ticks, only compared every pollInterval nodes
+	uint64 deadline = NO_TIME_LIMIT;
+	uint64 lastPoll = 0;
+	uint32 pollInterval = MIN_POLL_INTERVAL;
+	uint32 nodesUntilPoll = MIN_POLL_INTERVAL;
 	Move bestMoveThisIteration = 0;
+	// Deepest ply reached in the current iteration, qsearch included, for the info output
+	uint8 selDepth = 0;
+	// MultiPV line being searched, the root skips the first moves of the lines before it
+	uint8 pvIndex = 0;
 	bool fullSearch = true;
 	bool searchCanceled;
 } SearchContext;
@@ -34,6 +91,24 @@ typedef struct SearchStats {
 	uint64 ttStoresExact = 0;
 	uint64 ttStoresLower = 0;
 	uint64 ttStoresUpper = 0;
+	uint64 ttStoresEmpty = 0;
+	uint64 ttOverwrites = 0;
+	uint64 ttSameKeyUpdates = 0;
+	uint64 ttRejectedStores = 0;
+	uint64 ttKeyCollisions = 0;
+	uint64 ttHashfull = 0;
+
+	uint64 aspirationFailLows = 0;
+	uint64 aspirationFailHighs = 0;
+	uint64 aspirationResearches = 0;
+
+	uint64 nullMoveSearches = 0;
+	uint64 nullMoveCutoffs = 0;
+	uint64 reverseFutilityPrunes = 0;
+	uint64 futilityPrunes = 0;
+	uint64 razorPrunes = 0;
+	uint64 lateMovePrunes = 0;
+	uint64 historyPrunes = 0;
 
 	uint64 plyNodes[MAX_PLY] = {};
 	uint64 legalMoves[MAX_PLY] = {};
@@ -45,6 +120,7 @@ typedef struct SearchStats {
 	uint64 bucketCutoffs[B_Count] = {};
 	uint64 bucketIndexSum[B_Count] = {};
 	uint64 bucketFirstCutoffs[B_Count] = {};
+	uint64 bucketPruned[B_Count] = {};
 } SearchStats;
 
 typedef struct SearchTimes {
@@ -68,33 +144,63 @@ typedef struct SearchTimes {
 	uint64 repetitionPop = 0;
 } SearchTimes;
 
-typedef struct MovePool {
-	std::array<MoveList, MAX_PLY> pool;
+// Resolved at compile time: the root never takes TT cutoffs and records the best move,
+// PV nodes search their first child with the full window, NonPV nodes only see null windows.
+enum SearchNodeType : uint8 {
+	RootNode, PVNode, NonPVNode
+};
 
-	MoveList& getMoveList(uint8 depth) {
-		pool[depth].clear();
-		return pool[depth];
-	}
-} MovePool;
+// Instrumentation policies for alphaBetaSearch. Stats and timers are only touched behind
+// if constexpr (ENABLED), so the release search compiles them out entirely.
+typedef struct SearchInstrumentation {
+	static constexpr bool ENABLED = true;
 
-typedef struct MoveScorePool {
-	std::array<ScoreList, MAX_PLY> pool;
+	SearchStats& stats;
+	SearchTimes& times;
+	uint64 timerStart = 0;
 
-	ScoreList& getScoreList(uint8 depth) {
-		pool[depth].clear();
-		return pool[depth];
-	}
+	inline void startTimer() { timerStart = cntvct(); }
+	inline void stopTimer(uint64 SearchTimes::* field) { times.*field += cntvct() - timerStart; }
+} SearchInstrumentation;
+
+typedef struct NoInstrumentation {
+	static constexpr bool ENABLED = false;
+
+	inline void startTimer() {}
+	inline void stopTimer(uint64 SearchTimes::*) {}
+} NoInstrumentation;
+
+typedef struct PVLine {
+	std::array<Move, MAX_PLY> moves;
+	uint8 length = 0;
+} PVLine;
 
-} MoveScorePool;
+typedef struct RootLine {
+	PVLine pv;
+	int16 score = 0;
+} RootLine;
 
-typedef struct QuiescencePool {
-	std::array<MoveList, 5> pool;
+// Triangular PV table. Row ply holds the best line found from ply on, its moves sit at [ply, length[ply]).
+// A PV node clears its row on entry and rebuilds it from the child's row whenever a move raises alpha.
+typedef struct PVTable {
+	std::array<std::array<Move, MAX_PLY>, MAX_PLY> moves;
+	std::array<uint8, MAX_PLY> length{};
 
-	MoveList& getMoveList(uint8 depth) {
-		pool[depth].clear();
-		return pool[depth];
+	inline void clear(uint8 ply) { length[ply] = ply; }
+
+	inline void update(uint8 ply, Move move) {
+		moves[ply][ply] = move;
+		for (uint8 i = ply + 1; i < length[ply + 1]; i++) moves[ply][i] = moves[ply + 1][i];
+		length[ply] = std::max<uint8>(length[ply + 1], ply + 1);
+	}
+
+	inline PVLine rootLine() const {
+		PVLine line;
+		line.length = length[0];
+		for (uint8 i = 0; i < line.length; i++) line.moves[i] = moves[0][i];
+		return line;
 	}
-} QuiescencePool;
+} PVTable;
 
 constexpr std::array<std::array<uint8, MAX_MOVE_COUNT>, MAX_PLY> generateLateMoveReduction() {
 	std::array<std::array<uint8, MAX_MOVE_COUNT>, MAX_PLY> r;
@@ -120,29 +226,165 @@ constexpr std::array<std::array<uint8, MAX_MOVE_COUNT>, MAX_PLY> generateLateMov
 
 constexpr std::array<std::array<uint8, MAX_MOVE_COUNT>, MAX_PLY> LMR_TABLE = generateLateMoveReduction();
 
-Move iterativeDeepeningSearch(GameState& gameState, std::vector<MoveInfo>& history);
+// Moves tried before late quiets are pruned, indexed [improving][plies remaining]
+constexpr std::array<std::array<uint8, LATE_MOVE_PRUNING_MAX_DEPTH + 1>, 2> generateLateMovePruningCounts() {
+	std::array<std::array<uint8, LATE_MOVE_PRUNING_MAX_DEPTH + 1>, 2> counts;
+	for (uint8 improving = 0; improving < 2; improving++) {
+		for (uint8 depth = 0; depth <= LATE_MOVE_PRUNING_MAX_DEPTH; depth++) {
+			counts[improving][depth] = (3 + depth * depth) / (2 - improving);
+		}
+	}
+	return counts;
+}
+
+constexpr std::array<std::array<uint8, LATE_MOVE_PRUNING_MAX_DEPTH + 1>, 2> LATE_MOVE_PRUNING_COUNT = generateLateMovePruningCounts();
+
+Move iterativeDeepeningSearch(GameState& gameState, std::vector<MoveInfo>& history, const SearchLimits& limits = SearchLimits());
 
 // Used for GUI
 Move iterativeDeepeningSearch(GameState& gameState, std::vector<MoveInfo>& history, std::string& headerStats, std::string& TTStats, std::string& perPlyStats, std::string& searchTimes);
 
-// Debug version
-int16 alphaBetaSearch(GameState& gameState, EvalState& evalState, std::vector<MoveInfo>& history, SearchContext& context, 
-			  int16 alpha, int16 beta, uint8 pliesFromRoot, uint8 pliesRemaining, SearchStats& stats, SearchTimes& times);
+struct TranspositionTable;
+
+// Owns all mutable search state except the TT, which is shared. Lazy SMP runs one worker per
+// thread on a common TT; independent searches in one process each get a worker and their own TT.
+// The caller bumps the TT generation with newSearch() before each search.
+typedef struct SearchWorker {
+	TranspositionTable& tt;
+	std::atomic<bool>& stop;
+
+	RepetitionTable gameRepetitionHistory;
+	RepetitionTable searchRepetitionStack;
+	SearchStack searchStack;
+
+	HistoryTable historyTable;
+	CounterHistoryTable cHistoryTable;
+	FollowUpHistoryTable fHistoryTable;
+	CounterMoveTable counterMoveTable;
+	FollowUpMoveTable followUpMoveTable;
+
+	PVTable pvTable;
+	// Line of the last completed iteration, its move at a ply is only tried first while the
+	// search stack's followingPV says the path from the root still matches it
+	PVLine previousPV;
+
+	// MultiPV lines, best first. Line k of the running iteration replaces line k of the last one once it is
+	// searched, so lines [0, pvIndex) are always the current ones.
+	std::array<RootLine, MAX_MULTI_PV> rootLines;
+	uint8 multiPV = 1;
+
+	uint64 moveOverhead = DEFAULT_MOVE_OVERHEAD_MS;
+
+	// Nodes of the current search, qsearch included. Only the worker's own thread writes it, the main
+	// thread sums all workers for the info output.
+	std::atomic<uint64> nodes{0};
+
+	SearchWorker(TranspositionTable& tt, std::atomic<bool>& stop) : tt(tt), stop(stop) {}
+
+	SearchWorker(const SearchWorker&) = delete;
+	SearchWorker& operator=(const SearchWorker&) = delete;
+
+	Move iterativeDeepeningSearch(GameState& gameState, std::vector<MoveInfo>& history, const SearchLimits& limits = SearchLimits());
+
+	// Used for GUI
+	Move iterativeDeepeningSearch(GameState& gameState, std::vector<MoveInfo>& history, std::string& headerStats, std::string& TTStats, std::string& perPlyStats, std::string& searchTimes);
+
+	void helperSearch(GameState gameState, std::vector<MoveInfo> history, uint64 startTime, uint16 threadId);
 
-// Release version
-int16 alphaBetaSearch(GameState& gameState, EvalState& evalState, std::vector<MoveInfo>& history, SearchContext& context, 
-			  int16 alpha, int16 beta, uint8 pliesFromRoot, uint8 pliesRemaining);
+	// Searches the root at the given depth inside an aspiration window around previousScore
+	template <typename Instrumentation>
+	int16 aspirationSearch(GameState& gameState, EvalState& evalState, std::vector<MoveInfo>& history, SearchContext& context,
+			       int16 previousScore, int16 depth, Instrumentation& instrumentation);
+
+	// Instantiated in Search.cpp only, for SearchInstrumentation (debug, GUI) and NoInstrumentation (release)
+	template <SearchNodeType nodeType, typename Instrumentation>
+	int16 alphaBetaSearch(GameState& gameState, EvalState& evalState, std::vector<MoveInfo>& history, SearchContext& context, 
+			      int16 alpha, int16 beta, uint8 pliesFromRoot, uint8 pliesRemaining, Instrumentation& instrumentation);
+
+	int16 quiescenceSearch(GameState& gameState, EvalState& evalState, std::vector<MoveInfo>& history, SearchContext& context, Move pvMove,
+			       int16 alpha, int16 beta, uint8 pliesFromRoot, uint8 pliesRemaining);
+
+	inline bool isExcludedRootMove(Move move, const SearchContext& context) const {
+		for (uint8 i = 0; i < context.pvIndex; i++) {
+			if (rootLines[i].pv.length > 0 && rootLines[i].pv.moves[0].val == move.val) return true;
+		}
+		return false;
+	}
+
+	inline Move pvMoveAt(uint8 pliesFromRoot) {
+		return searchStack[pliesFromRoot].followingPV && pliesFromRoot < previousPV.length ? previousPV.moves[pliesFromRoot] : NULL_MOVE;
+	}
+
+	void clearHistoryTables();
+
+	inline void countNode() { nodes.store(nodes.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed); }
+
+	// This worker's nodes, plus the helpers' when it is the main worker running Lazy SMP
+	uint64 searchedNodes() const;
+
+	// Counts nodes down and only reads the clock and the stop flag once the count runs out.
+	// Once a poll canceled the search it stays stopped, so every ancestor gives up on its next move.
+	inline bool shouldStop(SearchContext& context) {
+		if (context.searchCanceled) return true;
+		if (--context.nodesUntilPoll > 0) return false;
+		return pollDeadline(context);
+	}
+
+	bool pollDeadline(SearchContext& context);
+} SearchWorker;
+
+// Tells a running search to return as soon as possible, safe to call from another thread.
+// clearSearchStop() re-arms the flag before a search is started.
+void requestSearchStop();
+
+void clearSearchStop();
+
+// Writes one line to stdout, serialized so search output and command replies never interleave
+void printLine(const std::string& line);
 
 void clearTranspositionTable();
 
+// Resizing and clearing only take effect once prepareSearchTables() runs
+void resizeTranspositionTable(uint64 sizeMB);
+
+// Allocates and zeroes the TT if a resize or clear is pending, returns true if it was reallocated.
+// Called on isready and at the start of every search.
+bool prepareSearchTables();
+
+bool saveTranspositionTable(const std::string& path);
+
+bool loadTranspositionTable(const std::string& path);
+
+// Number of Lazy SMP threads, including the main search thread. Helper workers are created or
+// dropped here and kept between searches.
+void setSearchThreads(uint16 threads);
+
+// Subtracted from the clock before budgeting, covers GUI and network lag
+void setMoveOverhead(uint64 ms);
+
+// Number of best root lines searched and reported, 1 is a normal search
+void setMultiPV(uint16 lines);
+
+// Clears the killer, history and counter move tables of the main and helper workers
+void clearHistoryTables();
+
+// Time to depth over a few fixed positions for 1 to 32 threads
+void runThreadScalingBenchmark(int16 depth);
+
+// Which page size backs each large table, see LargePages.h
+std::string getLargePageReport();
+
 uint8 getLMR(Move move, uint8 depth, uint8 moveNum, bool isCheck, bool inPV, Move ttMove, MTEntry killers, uint16 histScore);
 
-MoveBucket getBucketType(uint16 score);
+// Quiets go by the move, history scores overlap the bad capture range
+MoveBucket getBucketType(Move move, uint16 score);
 
 std::string getHeaderSearchStats(const SearchStats& s, int16 depth, const Move& bestMove, double elapsed_ms, uint64 zobrist);
 
 std::string getTTSearchStats(const SearchStats& s);
 
+std::string getTTSearchStatsJson(const SearchStats& s);
+
 std::string getPerPlySearchStats(const SearchStats& s);
 
 void printSearchStats(const SearchStats& s, int16 depth, const Move& bestMove, double elapsed_ms, uint64 zobrist);
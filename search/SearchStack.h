@@ -0,0 +1,90 @@
+#pragma once
+#include <array>
+
+#include "../chess/GameState.h"
+#include "Common.h"
+#include "Evaluation.h"
+#include "Move.h"
+
+// Plies from the root, main search and qsearch together
+constexpr uint64 MAX_PLY = 128;
+
+typedef struct ContEntry {
+	Piece p;
+	uint8 to;
+} ContEntry;
+
+typedef struct ScoreList {
+	std::array<uint16, MAX_MOVE_COUNT> list;
+	uint16 back = 0;
+
+	inline void clear() { back = 0; }
+	inline void push(uint16 score) { assert(back < MAX_MOVE_COUNT); list[back++] = score; }
+	inline bool isEmpty() { return back == 0; }
+	inline uint16* begin() { return &list[0]; }
+	inline uint16* end() { return &list[back]; }
+} ScoreList;
+
+typedef struct MTEntry {
+	Move move1;
+	Move move2;
+} MTEntry;
+
+// Everything the search keeps per ply. Entry ply describes the node at that ply and the move made from it.
+typedef struct SearchStackEntry {
+	Move move = NULL_MOVE;
+	// Moved piece and target of move, p is EMPTY after a null move so continuations stop there
+	ContEntry cont = {EMPTY, 0};
+	EvalDelta evalDelta;
+	MTEntry killers = {NULL_MOVE, NULL_MOVE};
+	// NEG_INF when in check
+	int16 staticEval = NEG_INF;
+	bool nullMove = false;
+	// Set while the path from the root matches the previous iteration's PV
+	bool followingPV = false;
+	MoveList moves;
+	ScoreList scores;
+} SearchStackEntry;
+
+// One preallocated entry per ply, nothing is allocated during the search. push and pop move the
+// height along with the moves made, at() looks back from the node at the current height.
+typedef struct SearchStack {
+	std::array<SearchStackEntry, MAX_PLY> entries;
+	uint8 height = 0;
+
+	inline SearchStackEntry& operator[](uint8 ply) { return entries[ply]; }
+
+	inline void push(const GameState& s, Move m) {
+		assert(height < MAX_PLY);
+		SearchStackEntry& e = entries[height++];
+		e.move = m;
+		e.cont = {s.pieceAt(m.getStartSquare()), (uint8)m.getTargetSquare()};
+		e.nullMove = false;
+	}
+
+	inline void pushNull() {
+		assert(height < MAX_PLY);
+		SearchStackEntry& e = entries[height++];
+		e.move = NULL_MOVE;
+		e.cont = {EMPTY, 0};
+		e.nullMove = true;
+	}
+
+	inline void pop() { assert(height > 0); height--; }
+
+	inline int8 at(uint8 lag, ContEntry& e) const {
+		if (lag >= height) return -1;
+		e = entries[height - 1 - lag].cont;
+		return e.p == EMPTY ? -1 : 0;
+	}
+
+	inline void storeKiller(uint8 ply, Move move) {
+		MTEntry& e = entries[ply].killers;
+		if (e.move1.val != move.val) {
+			e.move2 = e.move1;
+			e.move1 = move;
+		}
+	}
+
+	inline void clearKillers() { for (SearchStackEntry& e : entries) e.killers = {NULL_MOVE, NULL_MOVE}; }
+} SearchStack;
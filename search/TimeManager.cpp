@@ -0,0 +1,39 @@
+#include <algorithm>
+
+#include "TimeManager.h"
+
+void TimeManager::init(const SearchLimits& limits, Color us, uint64 moveOverhead, uint64 defaultMoveTime) {
+	softLimit = hardLimit = NO_TIME_LIMIT;
+	if (limits.infinite) return;
+
+	if (limits.moveTime >= 0) {
+		softLimit = hardLimit = std::max<int64>(1, limits.moveTime - static_cast<int64>(moveOverhead));
+		return;
+	}
+
+	if (limits.time[us] < 0) {
+		// Only a depth limit, search until it is reached
+		if (limits.depth > 0) return;
+		softLimit = hardLimit = defaultMoveTime;
+		return;
+	}
+
+	const uint64 available = std::max<int64>(1, limits.time[us] - static_cast<int64>(moveOverhead));
+	const uint64 increment = std::max<int64>(0, limits.inc[us]);
+	const uint64 movesToGo = limits.movesToGo > 0 ? std::min<uint64>(limits.movesToGo, MAX_MOVES_TO_GO) : DEFAULT_MOVES_TO_GO;
+
+	// Never plan to spend more than half the clock, and never run past 80% of it
+	softLimit = std::max<uint64>(1, std::min(available / movesToGo + increment * 3 / 4, available / 2));
+	hardLimit = std::max(softLimit, std::min(softLimit * 4, available * 4 / 5));
+}
+
+bool TimeManager::canStartIteration(uint64 elapsed, uint64 lastIteration, uint64 previousIteration) const {
+	if (softLimit == NO_TIME_LIMIT) return true;
+	if (elapsed >= softLimit) return false;
+
+	double branchingFactor = previousIteration > 0 ? static_cast<double>(lastIteration) / previousIteration : MAX_BRANCHING_FACTOR;
+	branchingFactor = std::clamp(branchingFactor, MIN_BRANCHING_FACTOR, MAX_BRANCHING_FACTOR);
+
+	// An iteration that would be cut off by the hard limit only wastes time
+	return elapsed + static_cast<uint64>(lastIteration * branchingFactor) < hardLimit;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "Common.h"
+
+constexpr uint64 NO_TIME_LIMIT = UINT64_MAX;
+constexpr uint64 DEFAULT_MOVE_OVERHEAD_MS = 10;
+constexpr uint64 MAX_MOVE_OVERHEAD_MS = 5000;
+
+// Moves left assumed when the GUI does not send movestogo
+constexpr uint64 DEFAULT_MOVES_TO_GO = 30;
+constexpr uint64 MAX_MOVES_TO_GO = 50;
+
+// The next iteration is predicted to take the last one times this, clamped to a sane range
+constexpr double MIN_BRANCHING_FACTOR = 1.5;
+constexpr double MAX_BRANCHING_FACTOR = 6.0;
+
+// Limits parsed from a go command, times in milliseconds
+typedef struct SearchLimits {
+	int64 time[2] = {-1, -1};
+	int64 inc[2] = {0, 0};
+	int64 movesToGo = 0;
+	int64 moveTime = -1;
+	int16 depth = 0;
+	bool infinite = false;
+} SearchLimits;
+
+typedef struct TimeManager {
+	// Soft: do not start another iteration after this. Hard: abort the running one.
+	uint64 softLimit = NO_TIME_LIMIT;
+	uint64 hardLimit = NO_TIME_LIMIT;
+
+	void init(const SearchLimits& limits, Color us, uint64 moveOverhead, uint64 defaultMoveTime);
+
+	// Called after each finished iteration with its duration and the one before it
+	bool canStartIteration(uint64 elapsed, uint64 lastIteration, uint64 previousIteration) const;
+} TimeManager;
@@ -0,0 +1,147 @@
+#include <fcntl.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "TranspositionTable.h"
+
+// Each thread zeroes its own page aligned slice. Pages are placed on first touch, so the
+// table ends up spread over the NUMA nodes of the clearing threads and is fully faulted in
+// before the search starts instead of lazily during it.
+void TranspositionTable::clearTable() {
+	generation8 = 0;
+	if (!table) return;
+
+	const uint64 bytes = bucketCount * sizeof(Bucket);
+	uint64 threadCount = std::clamp<uint64>(std::thread::hardware_concurrency(), 1, MAX_CLEAR_THREADS);
+	threadCount = std::min(threadCount, std::max<uint64>(1, bytes / MIN_CLEAR_BYTES_PER_THREAD));
+
+	if (threadCount == 1) {
+		std::memset(static_cast<void*>(table), 0, bytes);
+		return;
+	}
+
+	const uint64 bucketsPerPage = PAGE_SIZE_BYTES / sizeof(Bucket);
+	const uint64 pages = (bucketCount + bucketsPerPage - 1) / bucketsPerPage;
+	const uint64 slice = (pages + threadCount - 1) / threadCount * bucketsPerPage;
+
+	std::vector<std::thread> threads;
+	threads.reserve(threadCount);
+	for (uint64 start = 0; start < bucketCount; start += slice) {
+		uint64 count = std::min(slice, bucketCount - start);
+		threads.emplace_back([this, start, count]() {
+			std::memset(static_cast<void*>(table + start), 0, count * sizeof(Bucket));
+		});
+	}
+	for (std::thread& t : threads) t.join();
+}
+
+static TTSnapshotHeader makeSnapshotHeader(uint64 bucketCount, uint8 generation8) {
+	TTSnapshotHeader header{};
+	header.magic = TT_SNAPSHOT_MAGIC;
+	header.version = TT_SNAPSHOT_VERSION;
+	header.headerSize = sizeof(TTSnapshotHeader);
+	header.zobristSeed = ZOBRIST_SEED;
+	header.bucketCount = bucketCount;
+	header.bucketSize = sizeof(Bucket);
+	header.slotsPerBucket = BUCKET_SIZE;
+	header.entrySize = sizeof(Entry);
+	header.generation8 = generation8;
+	return header;
+}
+
+bool TranspositionTable::saveSnapshot(const std::string& path) const {
+	const uint64 tableBytes = bucketCount * sizeof(Bucket);
+	const uint64 fileBytes = sizeof(TTSnapshotHeader) + tableBytes;
+
+	int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		std::cerr << "Failed to open " << path << " for writing the transposition table." << std::endl;
+		return false;
+	}
+	if (ftruncate(fd, fileBytes) != 0) {
+		std::cerr << "Failed to size " << path << " to " << fileBytes << " bytes." << std::endl;
+		close(fd);
+		return false;
+	}
+
+	void* map = mmap(nullptr, fileBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		std::cerr << "Failed to map " << path << "." << std::endl;
+		return false;
+	}
+
+	TTSnapshotHeader header = makeSnapshotHeader(bucketCount, generation8);
+	std::memcpy(map, &header, sizeof(header));
+	std::memcpy(static_cast<uint8*>(map) + sizeof(header), static_cast<const void*>(table), tableBytes);
+
+	bool ok = msync(map, fileBytes, MS_SYNC) == 0;
+	munmap(map, fileBytes);
+	if (!ok) std::cerr << "Failed to flush " << path << "." << std::endl;
+	return ok;
+}
+
+bool TranspositionTable::loadSnapshot(const std::string& path) {
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		std::cerr << "Failed to open " << path << " for reading the transposition table." << std::endl;
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || static_cast<uint64>(st.st_size) < sizeof(TTSnapshotHeader)) {
+		std::cerr << path << " is not a transposition table snapshot." << std::endl;
+		close(fd);
+		return false;
+	}
+	const uint64 fileBytes = st.st_size;
+
+	void* map = mmap(nullptr, fileBytes, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		std::cerr << "Failed to map " << path << "." << std::endl;
+		return false;
+	}
+	madvise(map, fileBytes, MADV_SEQUENTIAL);
+
+	TTSnapshotHeader header;
+	std::memcpy(&header, map, sizeof(header));
+	TTSnapshotHeader expected = makeSnapshotHeader(header.bucketCount, header.generation8);
+
+	const char* error = nullptr;
+	if (header.magic != expected.magic) error = "is not a transposition table snapshot";
+	else if (header.version != expected.version || header.headerSize != expected.headerSize) error = "was written by an incompatible snapshot version";
+	else if (header.zobristSeed != expected.zobristSeed) error = "was written with different Zobrist keys";
+	else if (header.bucketSize != expected.bucketSize || header.slotsPerBucket != expected.slotsPerBucket || header.entrySize != expected.entrySize)
+		error = "was written with a different entry layout";
+	// Bounded before the size check, so bucketCount * sizeof(Bucket) cannot overflow
+	else if (header.bucketCount == 0 || header.bucketCount > MAX_TT_SIZE_MB * 1024 * 1024 / sizeof(Bucket))
+		error = "has an invalid table size";
+	else if (fileBytes != sizeof(TTSnapshotHeader) + header.bucketCount * sizeof(Bucket)) error = "is truncated";
+
+	if (error) {
+		std::cerr << path << " " << error << "." << std::endl;
+		munmap(map, fileBytes);
+		return false;
+	}
+
+	if (header.bucketCount != bucketCount && !resizeBuckets(header.bucketCount)) {
+		munmap(map, fileBytes);
+		return false;
+	}
+
+	std::memcpy(static_cast<void*>(table), static_cast<const uint8*>(map) + sizeof(header), bucketCount * sizeof(Bucket));
+	generation8 = header.generation8;
+	// The snapshot decides the size, a Hash value set since the last prepare() is dropped
+	if (pendingBuckets != 0 && pendingBuckets != bucketCount)
+		std::cout << "info string snapshot size " << sizeMB() << "MB replaces the requested " << pendingBuckets * sizeof(Bucket) / (1024 * 1024) << "MB hash" << std::endl;
+	pendingBuckets = 0;
+	pendingClear = false;
+
+	munmap(map, fileBytes);
+	return true;
+}
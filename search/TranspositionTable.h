@@ -1,14 +1,45 @@
 #pragma once
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
 
 #include "../chess/Common.h"
 #include "../chess/Move.h"
+#include "../helpers/LargePages.h"
+#include "../helpers/Zobrist.h"
 #include "Search.h"
 
 enum NodeType { Exact, UpperBound, LowerBound };
 enum LookUpType {None, Score, AlphaIncrease, BetaIncrease};
+enum StoreType { StoreEmpty, StoreOverwrite, StoreSameKey, StoreRejected };
 
-constexpr uint32 TABLE_SIZE = 524288;
-constexpr int16 SCORE_SENTINAL = -3103;
+constexpr uint64 DEFAULT_TT_SIZE_MB = 8;
+constexpr uint64 MIN_TT_SIZE_MB = 1;
+constexpr uint64 MAX_TT_SIZE_MB = 65536;
+constexpr uint64 CACHE_LINE_SIZE = 64;
+
+constexpr uint8 BUCKET_SIZE = 4;
+
+// Clearing is split across threads, each slice is at least this big so small tables stay single threaded
+constexpr uint64 MAX_CLEAR_THREADS = 64;
+constexpr uint64 MIN_CLEAR_BYTES_PER_THREAD = 4 * 1024 * 1024;
+constexpr uint64 PAGE_SIZE_BYTES = 4096;
+
+// genBound packs the node type in the low 2 bits and the generation in the upper 6
+constexpr uint8 BOUND_MASK = 0b11;
+constexpr uint8 GENERATION_DELTA = 1 << 2;
+constexpr uint16 GENERATION_CYCLE = 255 + GENERATION_DELTA;
+constexpr uint8 GENERATION_MASK = 0xFF & ~BOUND_MASK;
+
+// hashfull samples this many buckets from the start of the table, as in UCI the result is per mille
+constexpr uint64 HASHFULL_SAMPLE_BUCKETS = 1000;
+
+// Replacement value is depth - AGE_WEIGHT * age, so an entry loses a ply of worth for every search it sits through unused
+constexpr uint8 AGE_WEIGHT = 2;
 
 constexpr int16 MATE = 3200;
 constexpr int16 MATE_BUFFER = 512;
@@ -25,13 +56,65 @@ inline int16 fromTTScore(int16 s, uint8 pliesFromRoot) {
 	return (s > 0) ? (s - pliesFromRoot) : (s + pliesFromRoot);
 }
 
+// Depth is stored off by one so a zeroed entry (depth8 == 0) is empty and quiescence entries (depth 0) are not
 typedef struct Entry {
-	uint64 zobrist;
 	Move bestMove;
 	int16 score;
-	uint8 depth;
-	NodeType nodeType;
+	int16 staticEval;
+	uint8 depth8;
+	uint8 genBound;
+
+	inline bool isEmpty() const { return depth8 == 0; }
+	inline uint8 depth() const { return depth8 - 1; }
+	inline NodeType nodeType() const { return static_cast<NodeType>(genBound & BOUND_MASK); }
+	inline uint8 generation() const { return genBound & GENERATION_MASK; }
 } Entry;
+static_assert(sizeof(Entry) == sizeof(uint64));
+
+// The key is stored xored with the data so a slot torn by two threads writing at once fails the key check
+// instead of handing back a move or score that belongs to another position. Relaxed loads/stores are enough.
+typedef struct Slot {
+	std::atomic<uint64> keyXorData;
+	std::atomic<uint64> data;
+
+	inline bool read(uint64 zobrist, Entry& e) const {
+		uint64 d = data.load(std::memory_order_relaxed);
+		uint64 k = keyXorData.load(std::memory_order_relaxed);
+		if ((k ^ d) != zobrist) return false;
+		e = std::bit_cast<Entry>(d);
+		return !e.isEmpty();
+	}
+
+	inline void write(uint64 zobrist, const Entry& e) {
+		uint64 d = std::bit_cast<uint64>(e);
+		data.store(d, std::memory_order_relaxed);
+		keyXorData.store(zobrist ^ d, std::memory_order_relaxed);
+	}
+} Slot;
+static_assert(std::atomic<uint64>::is_always_lock_free);
+
+typedef struct alignas(CACHE_LINE_SIZE) Bucket {
+	Slot slots[BUCKET_SIZE];
+} Bucket;
+static_assert(sizeof(Bucket) == CACHE_LINE_SIZE);
+
+// Snapshot files are this header followed by the raw buckets. Anything that changes what a bucket means
+// (slot layout, key scheme, Zobrist keys) must bump the version or fail one of the header checks.
+constexpr uint64 TT_SNAPSHOT_MAGIC = 0x5454534B4E415053ULL; // "SNAPSKTT"
+constexpr uint32 TT_SNAPSHOT_VERSION = 1;
+
+typedef struct alignas(CACHE_LINE_SIZE) TTSnapshotHeader {
+	uint64 magic;
+	uint32 version;
+	uint32 headerSize;
+	uint64 zobristSeed;
+	uint64 bucketCount;
+	uint32 bucketSize;
+	uint32 slotsPerBucket;
+	uint32 entrySize;
+	uint8 generation8;
+} TTSnapshotHeader;
+static_assert(sizeof(TTSnapshotHeader) == CACHE_LINE_SIZE);
 
 typedef struct ttLookUpData {
 	LookUpType type;
@@ -39,19 +122,107 @@ typedef struct ttLookUpData {
 } ttLookUpData;
 
 typedef struct TranspositionTable {
-	Entry* table;
+	Bucket* table = nullptr;
+	uint64 bucketCount = 0;
+	uint8 generation8 = 0;
+	LargePageMode pageMode = PagesNormal;
+	uint64 mappedBytes = 0;
+
+	// Work deferred to prepare(), which runs on isready and before each search so that startup,
+	// setoption Hash and ucinewgame return immediately
+	uint64 pendingBuckets = 0;
+	bool pendingClear = false;
+
+	TranspositionTable() { resize(DEFAULT_TT_SIZE_MB); }
+	~TranspositionTable() { freeLargePages(table, mappedBytes); }
+
+	TranspositionTable(const TranspositionTable&) = delete;
+	TranspositionTable& operator=(const TranspositionTable&) = delete;
+
+	inline void resize(uint64 sizeMB) {
+		sizeMB = std::clamp(sizeMB, MIN_TT_SIZE_MB, MAX_TT_SIZE_MB);
+		pendingBuckets = sizeMB * 1024 * 1024 / sizeof(Bucket);
+	}
+
+	inline void requestClear() { pendingClear = true; }
 
-	TranspositionTable() { 
-		table = new Entry[TABLE_SIZE]{}; 
+	// Returns true when the table was (re)allocated
+	inline bool prepare() {
+		if (pendingBuckets != 0 && pendingBuckets != bucketCount) {
+			bool allocated = resizeBuckets(pendingBuckets);
+			// The old table stays, but a ucinewgame queued with the resize still has to clear it
+			if (!allocated && table) {
+				std::cout << "info string keeping the " << bucketCount * sizeof(Bucket) / (1024 * 1024) << "MB transposition table" << std::endl;
+				if (pendingClear) clearTable();
+			}
+			if (!allocated && !table) allocated = resizeBuckets(MIN_TT_SIZE_MB * 1024 * 1024 / sizeof(Bucket));
+			pendingBuckets = 0;
+			pendingClear = false;
+			return allocated;
+		}
+
+		pendingBuckets = 0;
+		if (pendingClear) clearTable();
+		pendingClear = false;
+		return false;
+	}
+
+	// Bucket count does not need to be a power of two since index() does not mask.
+	inline bool resizeBuckets(uint64 buckets) {
+		LargePageMode newMode;
+		uint64 newMappedBytes;
+		Bucket* newTable = static_cast<Bucket*>(allocLargePages(buckets * sizeof(Bucket), newMode, newMappedBytes));
+		if (!newTable) {
+			std::cerr << "Failed to allocate " << buckets * sizeof(Bucket) / (1024 * 1024) << "MB for the transposition table." << std::endl;
+			return false;
+		}
+
+		freeLargePages(table, mappedBytes);
+		table = newTable;
+		pageMode = newMode;
+		mappedBytes = newMappedBytes;
+		bucketCount = buckets;
 		clearTable();
+		return true;
 	}
 
-	inline void clearTable() {
-		for (uint32 i = 0; i < TABLE_SIZE; i++) table[i] = {0,NULL_MOVE,SCORE_SENTINAL,0,Exact};
+	bool saveSnapshot(const std::string& path) const;
+	bool loadSnapshot(const std::string& path);
+
+	inline uint64 sizeMB() const { return bucketCount * sizeof(Bucket) / (1024 * 1024); }
+
+	void clearTable();
+
+	// Called once per go, entries from earlier searches stay probeable but become cheaper to replace
+	inline void newSearch() { generation8 += GENERATION_DELTA; }
+
+	// Multiply-high maps the key onto [0, bucketCount) without needing a power of two size
+	inline uint64 index(uint64 zobrist) const {
+		return static_cast<uint64>((static_cast<unsigned __int128>(zobrist) * bucketCount) >> 64);
 	}
 
-	inline uint32 index(uint64 zobrist) const {
-		return (zobrist ^ (zobrist >> 32)) & (TABLE_SIZE - 1); // Or just zobrist & (TABLE_SIZE - 1) probably little to no difference
+	// Pulls the bucket into cache ahead of the probe, see GameState::keyAfter
+	inline void prefetch(uint64 zobrist) const { __builtin_prefetch(&table[index(zobrist)]); }
+
+	inline uint8 age(const Entry& e) const {
+		return (GENERATION_CYCLE + generation8 - e.genBound) & GENERATION_MASK;
+	}
+
+	inline int32 replaceValue(const Entry& e) const {
+		return e.depth8 - AGE_WEIGHT * (age(e) / GENERATION_DELTA);
+	}
+
+	// Share of sampled slots written during the current search
+	inline uint16 hashfull() const {
+		uint64 samples = std::min(HASHFULL_SAMPLE_BUCKETS, bucketCount);
+		uint64 used = 0;
+		for (uint64 b = 0; b < samples; b++) {
+			for (uint8 i = 0; i < BUCKET_SIZE; i++) {
+				Entry e = std::bit_cast<Entry>(table[b].slots[i].data.load(std::memory_order_relaxed));
+				if (!e.isEmpty() && e.generation() == generation8) used++;
+			}
+		}
+		return static_cast<uint16>(used * 1000 / (samples * BUCKET_SIZE));
 	}
 
 	inline NodeType getNodeType(int16 alpha, int16 beta, int16 originalAlpha) const {
@@ -60,68 +231,104 @@ typedef struct TranspositionTable {
 		return Exact;
 	}
 
-	inline void storeEntry(const Entry& entry) {
-		// NOTE: Might not working correctly depending on entry
-		uint32 i = index(entry.zobrist);
-		if (table[i].zobrist != 0 && table[i].depth > entry.depth)
-			return;
-		table[i] = entry;
+	inline bool probe(uint64 zobrist, Entry& entry) const {
+		const Bucket& bucket = table[index(zobrist)];
+		for (uint8 i = 0; i < BUCKET_SIZE; i++) {
+			if (bucket.slots[i].read(zobrist, entry)) return true;
+		}
+		return false;
 	}
 
-	inline void storeEntry(uint64 zobrist, Move m, uint8 pliesFromRoot, uint8 pliesRemaining, int16 alpha, int16 beta, int16 originalAlpha) {
+	inline StoreType storeEntry(uint64 zobrist, Move m, int16 score, int16 staticEval, uint8 depth, NodeType n) {
+		Bucket& bucket = table[index(zobrist)];
+
+		Slot* replace = nullptr;
+		Entry old{};
+		int32 replaceVal = INT32_MAX;
+		for (uint8 i = 0; i < BUCKET_SIZE; i++) {
+			Slot& slot = bucket.slots[i];
+			Entry e;
+			if (slot.read(zobrist, e)) {
+				replace = &slot;
+				old = e;
+				break;
+			}
+			// Other threads may be writing this slot, a torn read only costs a worse choice of victim
+			e = std::bit_cast<Entry>(slot.data.load(std::memory_order_relaxed));
+			int32 value = e.isEmpty() ? INT32_MIN : replaceValue(e);
+			if (value < replaceVal) {
+				replace = &slot;
+				replaceVal = value;
+			}
+		}
+
+		// Same position from this search with a deeper bound is kept unless the new one is exact
+		if (!old.isEmpty()) {
+			if (m.isNull()) m = old.bestMove;
+			if (n != Exact && age(old) == 0 && depth + 2 < old.depth()) {
+				old.bestMove = m;
+				replace->write(zobrist, old);
+				return StoreRejected;
+			}
+		}
+
+		StoreType type = !old.isEmpty() ? StoreSameKey : replaceVal == INT32_MIN ? StoreEmpty : StoreOverwrite;
+		replace->write(zobrist, {m, score, staticEval, static_cast<uint8>(depth + 1), static_cast<uint8>(generation8 | n)});
+		return type;
+	}
+
+	inline StoreType storeEntry(uint64 zobrist, Move m, uint8 pliesFromRoot, uint8 pliesRemaining, int16 alpha, int16 beta, int16 originalAlpha, int16 staticEval) {
 		// FIX: Should TTScore or alpha be used to get the node type?
 		NodeType n = getNodeType(alpha, beta, originalAlpha);
-		Entry e{zobrist, m, toTTScore(alpha, pliesFromRoot), pliesRemaining, n};
-		uint32 i = index(e.zobrist);
-		if (table[i].zobrist != 0 && table[i].depth > e.depth)
-			return;
-		table[i] = e;
+		return storeEntry(zobrist, m, toTTScore(alpha, pliesFromRoot), staticEval, pliesRemaining, n);
 	}
 
 	inline ttLookUpData lookUp(uint64 zobrist, int16 alpha, int16 beta, uint8 pliesRemaining, SearchStats& stats) {
-		Entry entry = table[index(zobrist)];
-		if (zobrist == entry.zobrist && entry.score != SCORE_SENTINAL) { 
+		Entry entry;
+		if (probe(zobrist, entry)) {
 			stats.ttHits++;
-			if (entry.depth >= pliesRemaining) {
+			if (entry.depth() >= pliesRemaining) {
 				stats.ttHitsUseful++;
-				
-				if (entry.nodeType == Exact) {
-					stats.ttHitCutoffs++; 
+
+				NodeType nodeType = entry.nodeType();
+				if (nodeType == Exact) {
+					stats.ttHitCutoffs++;
 					return {Score, entry.score};
 				}
-				if (entry.nodeType == LowerBound && entry.score >= beta) {
-					stats.ttHitCutoffs++; 
+				if (nodeType == LowerBound && entry.score >= beta) {
+					stats.ttHitCutoffs++;
 					return {BetaIncrease, entry.score};
 				}
-				if (entry.nodeType == UpperBound && entry.score <= alpha) {
-					stats.ttHitCutoffs++; 
+				if (nodeType == UpperBound && entry.score <= alpha) {
+					stats.ttHitCutoffs++;
 					return {AlphaIncrease, entry.score};
 				}
-				if (entry.nodeType == LowerBound) return {AlphaIncrease, std::max(alpha, entry.score)};
-				else if (entry.nodeType == UpperBound) return {BetaIncrease, std::min(beta, entry.score)};
+				if (nodeType == LowerBound) return {AlphaIncrease, std::max(alpha, entry.score)};
+				else if (nodeType == UpperBound) return {BetaIncrease, std::min(beta, entry.score)};
 			}
 		}
 		return {None, -1};
 	};
 
 	inline ttLookUpData lookUp(uint64 zobrist, int16 alpha, int16 beta, uint8 pliesRemaining) {
-		Entry entry = table[index(zobrist)];
-		if (zobrist == entry.zobrist && entry.score != SCORE_SENTINAL) { 
-			if (entry.depth >= pliesRemaining) {
-				if (entry.nodeType == Exact) return {Score, entry.score};
-				else if (entry.nodeType == LowerBound && entry.score >= beta) return {BetaIncrease, entry.score};
-				else if (entry.nodeType == UpperBound && entry.score <= alpha) return {AlphaIncrease, entry.score};
-		
-				if (entry.nodeType == LowerBound) return {AlphaIncrease, std::max(alpha, entry.score)};
-				else if (entry.nodeType == UpperBound) return {BetaIncrease, std::min(beta, entry.score)};
+		Entry entry;
+		if (probe(zobrist, entry)) {
+			if (entry.depth() >= pliesRemaining) {
+				NodeType nodeType = entry.nodeType();
+				if (nodeType == Exact) return {Score, entry.score};
+				else if (nodeType == LowerBound && entry.score >= beta) return {BetaIncrease, entry.score};
+				else if (nodeType == UpperBound && entry.score <= alpha) return {AlphaIncrease, entry.score};
+
+				if (nodeType == LowerBound) return {AlphaIncrease, std::max(alpha, entry.score)};
+				else if (nodeType == UpperBound) return {BetaIncrease, std::min(beta, entry.score)};
 			}
 		}
 		return { None, -1};
 	};
 
 	inline Move getTTMove(uint64 zobrist) {
-		Entry entry = table[index(zobrist)];
-		if (zobrist == entry.zobrist) return entry.bestMove;
+		Entry entry;
+		if (probe(zobrist, entry)) return entry.bestMove;
 		return NULL_MOVE;
 	}
 } TranspositionTable;